@@ -72,6 +72,7 @@
 
 #include "sid_settings.h"
 #include "sid_dmx.h"
+#include "sid_log.h"
 
 void setup()
 {
@@ -80,6 +81,8 @@ void setup()
     Serial.begin(115200);
     Serial.println();
 
+    log_setup();
+
     Wire.begin(-1, -1, 400000);
 
     dmx_boot();
@@ -10,9 +10,19 @@
 
 #include <Arduino.h>
 #include <esp_dmx.h>
+#include <Preferences.h>
+#include <esp_timer.h>
+#include <esp_freertos_hooks.h>
 
 #include "sid_dmx.h"
 #include "siddisplay.h"
+#include "sid_frame.h"
+#include "sid_log.h"
+#include "sid_stats.h"
+#ifdef SID_HAVE_NET
+#include <WiFi.h>
+#include "sid_netdmx.h"
+#endif
 
 // The SID display object
 sidDisplay sid(0x74, 0x72);
@@ -66,27 +76,188 @@ dmx_packet_t packet;
 
 uint8_t data[DMX_PACKET_SIZE];
 
-#define DMX_ADDRESS   34
-#define DMX_CHANNELS  12
+#define DMX_ADDRESS   34         // default; can be changed through RDM
+
+// Personalities (selectable through RDM)
+#define SID_PERS_STANDARD  1     // Brightness, effect ramp, 10 columns
+#define SID_PERS_COMPACT   2     // Brightness, effect ramp
+#define SID_PERS_EXTENDED  3     // Standard + peak dots + animation speed + strobe
+#define SID_PERS_GRAY      4     // Standard + column intensity
+#define SID_PERS_TEXT      5     // Standard + marquee text and speed
+#define SID_PERS_DEFAULT   SID_PERS_STANDARD
+
+static dmx_personality_t dmxPersonalities[] = {
+    { 12, "SID Standard" },
+    {  2, "SID Compact"  },
+    { 24, "SID Extended" },
+    { 22, "SID Grayscale" },
+    { 14, "SID Text" }
+};
+#define SID_NUM_PERS (sizeof(dmxPersonalities) / sizeof(dmxPersonalities[0]))
+
+// Footprint layout
+#define DMX_CH_BRI    0          // Master brightness
+#define DMX_CH_ERU    1          // Effect ramp up
+#define DMX_CH_COL    2          // Column heights (10)
+#define DMX_CH_DOT    12         // Column peak dots (10; extended)
+#define DMX_CH_SPEED  22         // Animation speed (extended)
+#define DMX_CH_STROBE 23         // Strobe (extended)
+#define DMX_CH_LEVEL  12         // Column intensity (10; grayscale)
+#define DMX_CH_TEXT   12         // Marquee text (text)
+#define DMX_CH_TSPEED 13         // Marquee scroll speed (text)
 
 #define DMX_VERIFY_CHANNEL 46    // must be set to DMX_VERIFY_VALUE
 #define DMX_VERIFY_VALUE   100   
 
-#if defined(DMX_USE_VERIFY) && (DMX_ADDRESS < DMX_VERIFY_CHANNEL)
-#define DMX_SLOTS_TO_RECEIVE (DMX_VERIFY_CHANNEL + 1)
-#else
-#define DMX_SLOTS_TO_RECEIVE (DMX_ADDRESS + DMX_CHANNELS)
-#endif
-
-// DMX footprint
-#define SID_BASE DMX_ADDRESS
+// DMX footprint (owned by receive task)
+static volatile uint16_t dmxAddress = DMX_ADDRESS;
+static volatile uint8_t  dmxPersonality = SID_PERS_DEFAULT;
+static uint8_t           dmxFootprint = 12;
+static size_t            dmxSlotsToReceive = DMX_ADDRESS + 12;
+
+// Persistent settings (NVS)
+static Preferences prefs;
+#define PREFS_NAMESPACE "sid-dmx"
+#define PREFS_ADDRESS   "addr"
+#define PREFS_PERS      "pers"
+
+// DMX reception runs in its own task on the core not used by
+// the Arduino loop task; the loop task does all rendering and
+// I2C traffic. Frames are passed through dmxFrames.
+#define DMX_RECV_STACK  4096
+#define DMX_RECV_PRIO   10
+
+// Art-Net/sACN reception has its own task and handoff; it
+// runs on the same core as the WiFi stack.
+#define NET_RECV_STACK  4096
+#define NET_RECV_PRIO   5
+#define NET_RECV_CORE   0
 
 unsigned long powerupMillis = 0;
 
-uint8_t cache[DMX_CHANNELS];
+uint8_t cache[SID_FRAME_SLOTS];
+static uint8_t cachePers = 0;
+
+// Animation speed in percent (extended personality)
+static unsigned int animSpeed = 100;
+
+// Master brightness of previous frame
+static int lastMbri = 0;
+
+static sidFrameHandoff dmxFrames;
+static TaskHandle_t    dmxRecvTaskHandle = NULL;
+static TaskHandle_t    renderTaskHandle = NULL;
+
+// The render (loop) task sleeps until a frame arrives or the next
+// animation step is due, but no longer than this (ms)
+#define RENDER_MAX_SLEEP  1000
+
+// Time a task spent waiting, as percentage of the last second.
+// This is not the idle time of the task's core (see below): The 
+// display flush task and its timers share the render core, and 
+// the receive core also runs the WiFi stack.
+struct idleMeter {
+    unsigned long winStart;
+    unsigned long idleUs;
+    uint8_t       pct;
+};
+static idleMeter renderIdle = { 0, 0, 0 };
+static idleMeter recvIdle = { 0, 0, 0 };
+
+// Idle time of each core, as percentage of the last second: The 
+// idle hooks keep the core spinning (instead of waiting for an 
+// interrupt) and add up the cycles between two calls; a gap longer
+// than CPU_IDLE_GAP means that a task or an interrupt ran.
+#define CPU_IDLE_GAP  2000    // cycles
+static volatile uint32_t cpuIdleCycles[2] = { 0, 0 };
+static uint32_t          cpuIdleLast[2] = { 0, 0 };
+static uint32_t          cpuIdleBase[2] = { 0, 0 };
+static unsigned long     cpuIdleWinStart = 0;
+static uint8_t           cpuIdlePct[2] = { 0, 0 };
+
+/*
+ * Column interpolation: In manual mode, DMX sets target heights;
+ * a render tick at SID_RENDER_HZ moves each column towards its 
+ * target by at most SID_SLEW_RATE LEDs per second. Heights are 
+ * 8.8 fixed point.
+ */
+#define RENDER_TICK_US  (1000000 / SID_RENDER_HZ)
+#define SLEW_PER_TICK   (SID_SLEW_RATE * 256 / SID_RENDER_HZ)
+static int32_t       colTarget[10];
+static int32_t       colCur[10];
+static uint8_t       colDot[10];        // Peak dot DMX value (0 = none)
+static bool          interpActive = false;
+static bool          colShown = false;  // colCur is what the display shows
+static unsigned long nextTickUs = 0;
+static unsigned long lastTickUs = 0;
+static sidHisto      tickJitter;        // |tick interval - RENDER_TICK_US|
+static uint32_t      tickCount = 0, tickRate = 0;
+static unsigned long tickRateStart = 0;
+
+/*
+ * Marquee (text personality): The display scrolls one of the 
+ * SID_TEXTS upwards, one row per step.
+ */
+static const char   *marqueeTexts[] = { SID_TEXTS };
+#define NUM_TEXTS   (int)(sizeof(marqueeTexts) / sizeof(marqueeTexts[0]))
+static bool          marqueeActive = false;
+static int           marqueeText = -1;
+static unsigned long marqueeStepUs = 1000000 / SID_TEXT_SPEED;
+static unsigned long nextMarqueeUs = 0;
+
+/*
+ * Strobe (extended personality): Slow rates use the HT16K33's 
+ * blink; faster ones switch the display on and off through the
+ * display setup command, which leaves the display RAM alone and
+ * costs one byte per chip. The same goes for RDM identify, which
+ * blinks the fully lit display.
+ */
+#define STROBE_HW_MAX       99   // DMX values up to this use hardware blink
+static bool          strobeActive = false;  // Software strobe
+static bool          strobeLit = true;
+static unsigned long strobeHalfUs = 0;
+static unsigned long nextStrobeUs = 0;
+
+static volatile bool rdmIdentify = false;   // Set by receive task
+static bool          identifying = false;
+
+/*
+ * Latency of DMX frames, from packet completion in the driver
+ * to the end of each chip's I2C transaction. Receive time and 
+ * setDisplay() entry are taken from the system timer (valid 
+ * across cores), all later stages from the CPU cycle counter 
+ * of the render core (the display flush task runs there, too).
+ */
+#define LAT_QUEUE     0     // Packet complete -> setDisplay()
+#define LAT_DECODE    1     // setDisplay() -> buffer ready
+#define LAT_CHIP0     2     // Buffer ready -> 1st chip written (incl. flush queue)
+#define LAT_CHIP1     3     // 1st chip written -> 2nd chip written (tearing)
+#define LAT_TOTAL     4     // Packet complete -> 2nd chip written
+#define LAT_NUM       5
+static const char *latNames[LAT_NUM] = {
+    "Latency: queue", "Latency: decode", "Latency: chip 1", "Latency: chip 2", "Latency: total"
+};
+static sidHisto latHisto[LAT_NUM];
+static uint32_t latRxUs, latEntryUs, latEntryCyc;
+
+static bool                   dmxIsConnected = false;
+static volatile unsigned long lastDMXpacket = 0;
+
+#if DMX_FILTER_MODE > 0
+// Glitch filter state (owned by receive task)
+static uint8_t  fltHist[2][SID_FRAME_SLOTS];  // Median: previous two frames
+static uint8_t  fltOut[SID_FRAME_SLOTS];      // Persist: shown values
+static uint8_t  fltCand[SID_FRAME_SLOTS];     // Persist: pending values
+static uint8_t  fltCnt[SID_FRAME_SLOTS];      // Persist: frames pending
+static uint32_t fltFrames = 0;                // Frames since reset
+static unsigned long fltLast = 0;
+#endif
 
-static bool          dmxIsConnected = false;
-static unsigned long lastDMXpacket = 0;
+#ifdef SID_HAVE_NET
+static sidFrameHandoff        netFrames;
+static TaskHandle_t           netRecvTaskHandle = NULL;
+static volatile unsigned long lastNetPacket = 0;
+#endif
 
 #define TT_SQF_LN 51
 static const uint8_t ttledseqfull[TT_SQF_LN][10] = {
@@ -240,7 +411,24 @@ static const uint8_t staleledseq[STT_SQ_LN][10] = {
 
 static uint8_t efxRanges[256] = { 0 };
 
-static bool setDisplay(int base);
+static void dmxRecvTask(void *pvParameters);
+static unsigned long renderTimeout(unsigned long lastPacket);
+static void idleMeterWait(idleMeter *m, unsigned long timeout);
+static void idleMeterAdd(idleMeter *m, unsigned long startUs, unsigned long endUs);
+static bool cpuIdleHook0();
+static bool cpuIdleHook1();
+static void cpuIdleUpdate();
+#ifdef SID_HAVE_NET
+static void netRecvTask(void *pvParameters);
+#endif
+static bool setDisplay(const sidFrame *frame);
+static void showFrame();
+static bool renderColumns();
+static void renderTick();
+static void marqueeTick();
+static void strobeTick();
+static void identify(bool on);
+static void frameFlushed(uint32_t tag, uint32_t ready, uint32_t first, uint32_t second);
 static void showIdle(bool forceUpdate = false, bool freezeBaseLine = false);
 
 
@@ -248,9 +436,63 @@ static void showIdle(bool forceUpdate = false, bool freezeBaseLine = false);
 
 static void invalidateCache()
 {
-    for(int i = 0; i < DMX_CHANNELS; i++) {
+    for(int i = 0; i < SID_FRAME_SLOTS; i++) {
         cache[i] = rand() % 255;
     }
+    cachePers = 0;
+}
+
+/*
+ * Set personality and start address of our footprint, and the
+ * number of slots to wait for in dmx_receive_num(): A frame is 
+ * processed as soon as the last slot we need has arrived.
+ * Returns the (possibly corrected) address.
+ */
+static uint16_t setDMXFootprint(uint16_t addr, uint8_t pers)
+{
+    if(pers < 1 || pers > SID_NUM_PERS) pers = SID_PERS_DEFAULT;
+
+    dmxPersonality = pers;
+    dmxFootprint = dmxPersonalities[pers - 1].footprint;
+    
+    if(addr < 1) addr = 1;
+    if(addr > DMX_PACKET_SIZE - dmxFootprint) addr = DMX_PACKET_SIZE - dmxFootprint;
+
+    dmxAddress = addr;
+    dmxSlotsToReceive = addr + dmxFootprint;
+    
+    #ifdef DMX_USE_VERIFY
+    if(dmxSlotsToReceive < DMX_VERIFY_CHANNEL + 1) {
+        dmxSlotsToReceive = DMX_VERIFY_CHANNEL + 1;
+    }
+    #endif
+
+    return addr;
+}
+
+// Pick up start address and personality changes made through RDM
+static bool checkDMXFootprint()
+{
+    uint16_t addr = dmx_get_start_address(dmxPort);
+    uint8_t  pers = dmx_get_current_personality(dmxPort);
+
+    if(addr == dmxAddress && pers == dmxPersonality)
+        return false;
+
+    if(setDMXFootprint(addr, pers) != addr) {
+        dmx_set_start_address(dmxPort, dmxAddress);
+    }
+    if(pers != dmxPersonality) {
+        dmx_set_current_personality(dmxPort, dmxPersonality);
+    }
+
+    prefs.putUShort(PREFS_ADDRESS, dmxAddress);
+    prefs.putUChar(PREFS_PERS, dmxPersonality);
+    
+    log_printf(LOG_INFO, "DMX start address now %d, personality %d (%d channels)\n", 
+          dmxAddress, dmxPersonality, dmxFootprint);
+
+    return true;
 }
 
 /*********************************************************************************
@@ -290,10 +532,6 @@ void dmx_setup()
       .software_version_label = "SID-DMXv1",
       .queue_size_max = 32
     };
-    dmx_personality_t personalities[] = {
-        {DMX_CHANNELS, "SID Personality"}
-    };
-    int personality_count = 1;
 
     Serial.println(F("SID DMX version " SID_VERSION " " SID_VERSION_EXTRA));
     Serial.println(F("(C) 2024 Thomas Winischhofer (A10001986)"));
@@ -322,8 +560,46 @@ void dmx_setup()
     }
 
     // Start the DMX stuff
-    dmx_driver_install(dmxPort, &config, personalities, personality_count);
+    dmx_driver_install(dmxPort, &config, dmxPersonalities, SID_NUM_PERS);
     dmx_set_pin(dmxPort, transmitPin, receivePin, enablePin);
+
+    // Restore personality and start address
+    prefs.begin(PREFS_NAMESPACE);
+    setDMXFootprint(prefs.getUShort(PREFS_ADDRESS, DMX_ADDRESS), 
+                    prefs.getUChar(PREFS_PERS, SID_PERS_DEFAULT));
+    dmx_set_current_personality(dmxPort, dmxPersonality);
+    dmx_set_start_address(dmxPort, dmxAddress);
+    Serial.printf("DMX start address %d, personality %d (%d channels)\n", 
+          dmxAddress, dmxPersonality, dmxFootprint);
+
+    // We are running in the loop task, which is the render task
+    renderTaskHandle = xTaskGetCurrentTaskHandle();
+
+    // Display I2C traffic in a task on our core
+    sid.setFlushCallback(frameFlushed);
+    sid.setGrayBits(SID_GRAY_BITS);
+    sid.setScrubBudget(SID_SCRUB_BUDGET);
+    sid.setCurrentBudget(SID_CURRENT_BUDGET, SID_LED_CURRENT);
+    #ifdef SID_FLUSH_ASYNC
+    if(!sid.beginAsync(xPortGetCoreID())) {
+        Serial.println("Failed to start display flush task");
+    }
+    #endif
+
+    if(esp_register_freertos_idle_hook_for_cpu(cpuIdleHook0, 0) != ESP_OK ||
+       esp_register_freertos_idle_hook_for_cpu(cpuIdleHook1, 1) != ESP_OK) {
+        Serial.println("Failed to install CPU idle hooks");
+    }
+
+    // Start receiver on the other core
+    xTaskCreatePinnedToCore(dmxRecvTask, "dmxRecv", DMX_RECV_STACK, NULL, 
+                            DMX_RECV_PRIO, &dmxRecvTaskHandle, 
+                            xPortGetCoreID() ? 0 : 1);
+
+    #ifdef SID_HAVE_NET
+    xTaskCreatePinnedToCore(netRecvTask, "netRecv", NET_RECV_STACK, NULL, 
+                            NET_RECV_PRIO, &netRecvTaskHandle, NET_RECV_CORE);
+    #endif
 }
 
 
@@ -336,57 +612,64 @@ void dmx_setup()
 void dmx_loop() 
 {
     bool forceUpdate = false;
-                    
-    if(dmx_receive_num(dmxPort, &packet, DMX_SLOTS_TO_RECEIVE, 0)) {
-        
-        lastDMXpacket = millis();
-    
-        if(!packet.err) {
+    const sidFrame *frame;
+    unsigned long lastPacket;
+
+    cpuIdleUpdate();
+
+    // Only the newest frame is rendered; any frames received
+    // while we were busy rendering are skipped.
+    frame = dmxFrames.acquire();
+
+    #ifdef SID_HAVE_NET
+    {
+        // Network input is ignored while wired DMX is connected
+        const sidFrame *netFrame = netFrames.acquire();
+        lastPacket = lastDMXpacket;
+        if(netFrame && (millis() - lastPacket > 1250)) {
+            frame = netFrame;
+        }
+    }
+    #endif
 
-            if(!dmxIsConnected) {
-                Serial.println("DMX is connected");
-                dmxIsConnected = true;
-            }
-      
-            dmx_read(dmxPort, data, packet.size);
-      
-            if(!data[0]) {
-
-                #ifdef DMX_USE_VERIFY
-                if(data[DMX_VERIFY_CHANNEL] == DMX_VERIFY_VALUE) {
-                #endif
-                    
-                    if(memcmp(cache, data + SID_BASE, DMX_CHANNELS)) {
-                        forceUpdate = setDisplay(SID_BASE);
-                        memcpy(cache, data + SID_BASE, DMX_CHANNELS);
-                        #ifdef SID_DBG
-                        Serial.println("setDisplay called");
-                        #endif
-                    }
+    // RDM identify takes over the display; frames are dropped
+    if(rdmIdentify != identifying) {
+        identifying = rdmIdentify;
+        identify(identifying);
+    }
+    if(identifying) {
+        idleMeterWait(&renderIdle, RENDER_MAX_SLEEP);
+        return;
+    }
 
-                #ifdef DMX_USE_VERIFY
-                } else {
+    if(frame) {
 
-                    Serial.printf("Bad verification value on channel %d: %d (should be %d)\n", 
-                          DMX_VERIFY_CHANNEL, data[DMX_VERIFY_CHANNEL], DMX_VERIFY_VALUE);
-                  
-                }
-                #endif
-                
-            } else {
-              
-                Serial.printf("Unrecognized start code %d (0x%02x)", data[0], data[0]);
-                
-            }
-          
-        } else {
-            
-            Serial.printf("DMX error: %d\n", packet.err);
-            
+        if(!dmxIsConnected) {
+            log_printf(LOG_INFO, "DMX is connected\n");
+            dmxIsConnected = true;
+        }
+
+        if(frame->personality != cachePers || memcmp(cache, frame->slots, frame->numSlots)) {
+            forceUpdate = setDisplay(frame);
+            memcpy(cache, frame->slots, frame->numSlots);
+            cachePers = frame->personality;
+            SID_DBGLOG("setDisplay called\n");
         }
 
     }
 
+    if(interpActive && (long)(micros() - nextTickUs) >= 0) {
+        renderTick();
+    }
+
+    if(marqueeActive && (long)(micros() - nextMarqueeUs) >= 0) {
+        marqueeTick();
+    }
+
+    if(strobeActive && (long)(micros() - nextStrobeUs) >= 0) {
+        strobeTick();
+    }
+
     switch(modeOfOperation) {
     case 0:
         break;
@@ -400,13 +683,542 @@ void dmx_loop()
         break;
     }
 
-    if(dmxIsConnected && (millis() - lastDMXpacket > 1250)) {
-        Serial.println("DMX was disconnected");
+    lastPacket = lastDMXpacket;
+    #ifdef SID_HAVE_NET
+    if((long)(lastNetPacket - lastPacket) > 0) {
+        lastPacket = lastNetPacket;
+    }
+    #endif
+    if(dmxIsConnected && (millis() - lastPacket > 1250)) {
+        log_printf(LOG_INFO, "DMX was disconnected\n");
         dmxIsConnected = false;
         invalidateCache();
     }
+
+    // Sleep until next frame or next animation step
+    idleMeterWait(&renderIdle, renderTimeout(lastPacket));
+}
+
+static void idleMeterAdd(idleMeter *m, unsigned long startUs, unsigned long endUs)
+{
+    m->idleUs += endUs - startUs;
+    if(endUs - m->winStart >= 1000000) {
+        unsigned long win = endUs - m->winStart;
+        if(win < 2000000) {
+            m->pct = m->idleUs * 100 / win;
+        }
+        m->winStart = endUs;
+        m->idleUs = 0;
+    }
+}
+
+static inline bool cpuIdleHook(int core)
+{
+    uint32_t now = ESP.getCycleCount();
+    uint32_t gap = now - cpuIdleLast[core];
+
+    if(gap < CPU_IDLE_GAP) {
+        cpuIdleCycles[core] += gap;
+    }
+    cpuIdleLast[core] = now;
+
+    // Do not let the idle task wait for an interrupt
+    return false;
+}
+
+static bool cpuIdleHook0()
+{
+    return cpuIdleHook(0);
 }
 
+static bool cpuIdleHook1()
+{
+    return cpuIdleHook(1);
+}
+
+// Called by the render task at least every RENDER_MAX_SLEEP
+static void cpuIdleUpdate()
+{
+    unsigned long now = micros();
+    unsigned long win = now - cpuIdleWinStart;
+
+    if(win < 1000000)
+        return;
+
+    for(int i = 0; i < 2; i++) {
+        uint32_t cycles = cpuIdleCycles[i];
+        if(win < 2000000) {
+            uint32_t pct = (uint64_t)(cycles - cpuIdleBase[i]) * 100 / ((uint64_t)win * ESP.getCpuFreqMHz());
+            cpuIdlePct[i] = (pct > 100) ? 100 : pct;
+        }
+        cpuIdleBase[i] = cycles;
+    }
+    cpuIdleWinStart = now;
+}
+
+// Block render task until notified by a receive task, or timeout (ms)
+static void idleMeterWait(idleMeter *m, unsigned long timeout)
+{
+    unsigned long startUs;
+
+    if(!timeout)
+        return;
+
+    startUs = micros();
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout));
+    idleMeterAdd(m, startUs, micros());
+}
+
+/*
+ * Time (ms) until dmx_loop() needs to run again without a new 
+ * frame arriving: Next idle animation step, or DMX timeout.
+ */
+static unsigned long renderTimeout(unsigned long lastPacket)
+{
+    unsigned long now = millis();
+    unsigned long timeout = RENDER_MAX_SLEEP, interval, elapsed;
+
+    if(interpActive) {
+        long wait = (long)(nextTickUs - micros());
+        if(wait <= 0) return 0;
+        timeout = min(timeout, (unsigned long)(wait + 999) / 1000);
+    }
+
+    if(marqueeActive) {
+        long wait = (long)(nextMarqueeUs - micros());
+        if(wait <= 0) return 0;
+        timeout = min(timeout, (unsigned long)(wait + 999) / 1000);
+    }
+
+    if(strobeActive) {
+        long wait = (long)(nextStrobeUs - micros());
+        if(wait <= 0) return 0;
+        timeout = min(timeout, (unsigned long)(wait + 999) / 1000);
+    }
+
+    if(modeOfOperation && gpsSpeed >= 0) {
+        interval = (useGPSS ? 500 : idleDelay) * 100 / animSpeed;
+        elapsed = now - lastChange;
+        if(elapsed >= interval) return 0;
+        timeout = min(timeout, interval - elapsed);
+    }
+
+    if(dmxIsConnected) {
+        elapsed = now - lastPacket;
+        if(elapsed > 1250) return 0;
+        timeout = min(timeout, 1250 - elapsed + 1);
+    }
+
+    return timeout;
+}
+
+
+// Move columns towards their targets and draw them into the 
+// buffer; returns true if some column has not reached its target
+static bool renderColumns()
+{
+    bool moving = false;
+    
+    for(int i = 0; i < 10; i++) {
+        int32_t d = colTarget[i] - colCur[i];
+        if(SID_SLEW_RATE && d > SLEW_PER_TICK) {
+            colCur[i] += SLEW_PER_TICK;
+            moving = true;
+        } else if(SID_SLEW_RATE && d < -SLEW_PER_TICK) {
+            colCur[i] -= SLEW_PER_TICK;
+            moving = true;
+        } else {
+            colCur[i] = colTarget[i];
+        }
+        sid.drawBarWithHeight(i, (colCur[i] + 128) >> 8);
+        if(colDot[i]) {
+            sid.drawDot(i, (colDot[i] - 1) * 20 / 255);
+        }
+    }
+
+    return moving;
+}
+
+// Fixed-rate render tick, runs while columns are moving
+static void renderTick()
+{
+    unsigned long now = micros();
+    unsigned long interval = now - lastTickUs;
+
+    histo_add(&tickJitter, (interval > RENDER_TICK_US) ? 
+                interval - RENDER_TICK_US : RENDER_TICK_US - interval);
+    lastTickUs = now;
+    tickCount++;
+    if(now - tickRateStart >= 1000000) {
+        tickRate = tickCount;
+        tickCount = 0;
+        tickRateStart = now;
+    }
+
+    interpActive = renderColumns();
+    sid.show();
+
+    // Keep the grid; if we fell behind by more than a tick, restart it
+    nextTickUs += RENDER_TICK_US;
+    if((long)(now - nextTickUs) >= 0) {
+        nextTickUs = now + RENDER_TICK_US;
+    }
+}
+
+// Marquee step: Scroll by one row
+static void marqueeTick()
+{
+    unsigned long now = micros();
+
+    sid.marqueeStep();
+    sid.show();
+
+    nextMarqueeUs += marqueeStepUs;
+    if((long)(now - nextMarqueeUs) >= 0) {
+        nextMarqueeUs = now + marqueeStepUs;
+    }
+}
+
+// Software strobe: Switch display on or off
+static void strobeTick()
+{
+    unsigned long now = micros();
+
+    strobeLit = !strobeLit;
+    if(strobeLit) {
+        sid.on();
+    } else {
+        sid.off();
+    }
+
+    nextStrobeUs += strobeHalfUs;
+    if((long)(now - nextStrobeUs) >= 0) {
+        nextStrobeUs = now + strobeHalfUs;
+    }
+}
+
+// Strobe channel: 0-9 off; 10-99 hardware blink at 0.5, 1, 2Hz;
+// 100-255 software strobe 3-25Hz
+static void setStrobe(uint8_t val)
+{
+    if(val <= STROBE_HW_MAX) {
+        strobeActive = false;
+        strobeLit = true;
+        sid.setBlink((val < 10) ? SD_BLINK_OFF : 
+                     ((val < 40) ? SD_BLINK_05HZ : 
+                     ((val < 70) ? SD_BLINK_1HZ : SD_BLINK_2HZ)));
+        return;
+    }
+
+    sid.setBlink(SD_BLINK_OFF);
+    strobeHalfUs = 500000 / (3 + (val - STROBE_HW_MAX - 1) * 22 / (255 - STROBE_HW_MAX - 1));
+    if(!strobeActive) {
+        strobeActive = true;
+        strobeLit = true;
+        nextStrobeUs = micros() + strobeHalfUs;
+    }
+}
+
+// RDM identify: Whole display lit, blinking in hardware; when 
+// done, the previous display state is restored, and the next frame
+// is drawn as usual
+static void identify(bool on)
+{
+    static uint8_t savedMaster, savedBri, savedBlink;
+    static uint8_t savedLevel[10];
+    static bool    savedOn;
+    static sidField savedField;
+
+    if(on) {
+        // A software strobe restarts with the next frame
+        savedOn = sid.isOn() || strobeActive;
+        interpActive = false;
+        marqueeActive = false;
+        strobeActive = false;
+        strobeLit = true;
+        sid.getField(&savedField);
+        savedMaster = sid.getMaster();
+        savedBri = sid.getBrightness();
+        savedBlink = sid.getBlink();
+        for(int i = 0; i < 10; i++) {
+            savedLevel[i] = sid.getColumnLevel(i);
+        }
+        sid.resetColumnLevels();
+        sid.lampTest();
+        sid.setBrightness(15);
+        sid.setMaster(255);
+        sid.setBlink(SD_BLINK_2HZ);
+        sid.on();
+    } else {
+        for(int i = 0; i < 10; i++) {
+            sid.setColumnLevel(i, savedLevel[i]);
+        }
+        sid.setBlink(savedBlink);
+        sid.setBrightness(savedBri);
+        sid.setMaster(savedMaster);
+        if(savedOn) {
+            sid.on();
+        } else {
+            sid.off();
+        }
+        // lampTest() overwrote the image; manual mode seeds its
+        // column heights from what is shown
+        sid.drawField(&savedField);
+        sid.show();
+        colShown = false;
+        invalidateCache();
+    }
+    log_printf(LOG_INFO, "RDM identify %d\n", on);
+}
+
+#if DMX_FILTER_MODE > 0
+static inline uint8_t median3(uint8_t a, uint8_t b, uint8_t c)
+{
+    if(a > b) { uint8_t t = a; a = b; b = t; }
+    return (c <= a) ? a : ((c >= b) ? b : c);
+}
+
+/*
+ * Temporal glitch filter
+ * 
+ * Runs on every received frame (before frames are coalesced), 
+ * modifies the footprint in place. Restarts after a footprint
+ * change or a gap in reception, so the first frame is never 
+ * held back.
+ */
+static void filterFrame(uint8_t *fp, int num, bool reset)
+{
+    unsigned long now = millis();
+    uint32_t held = 0;
+
+    if(reset || now - fltLast > 1250) {
+        fltFrames = 0;
+    }
+    fltLast = now;
+
+    for(int i = 0; i < num; i++) {
+        uint8_t cur = fp[i];
+        #if DMX_FILTER_MODE == 1
+        if(fltFrames >= 2) {
+            fp[i] = median3(fltHist[0][i], fltHist[1][i], cur);
+        }
+        fltHist[0][i] = fltFrames ? fltHist[1][i] : cur;
+        fltHist[1][i] = cur;
+        #else
+        if(!fltFrames || abs((int)cur - (int)fltOut[i]) <= DMX_FILTER_DELTA) {
+            fltOut[i] = cur;
+            fltCnt[i] = 0;
+        } else if(fltCnt[i] && abs((int)cur - (int)fltCand[i]) <= DMX_FILTER_DELTA) {
+            fltCand[i] = cur;
+            if(++fltCnt[i] >= DMX_FILTER_FRAMES) {
+                fltOut[i] = cur;
+                fltCnt[i] = 0;
+            }
+        } else {
+            fltCand[i] = cur;
+            fltCnt[i] = 1;
+            if(DMX_FILTER_FRAMES <= 1) {
+                fltOut[i] = cur;
+                fltCnt[i] = 0;
+            }
+        }
+        fp[i] = fltOut[i];
+        #endif
+        if(fp[i] != cur) held++;
+    }
+
+    fltFrames++;
+
+    if(held) {
+        stats_filtered(held);
+    }
+}
+#endif
+
+/*
+ * Print statistics; called from the log task on request, 
+ * so it may take its time.
+ */
+void dmx_printStatus()
+{
+    stats_print();
+    Serial.printf("Frames skipped: %u\n", dmxFrames.getSkipped());
+    #ifdef SID_HAVE_NET
+    Serial.printf("Network frames skipped: %u\n", netFrames.getSkipped());
+    #endif
+    Serial.printf("HT16K33 commands saved: %u\n", sid.getCmdsSaved());
+    if(sid.getShowAvgUs()) {
+        Serial.printf("Display: %u frames, %u us/frame (max %u fps)\n", 
+              sid.getShowCount(), sid.getShowAvgUs(), 1000000 / sid.getShowAvgUs());
+    }
+    if(sid.getSkewCount()) {
+        Serial.printf("Inter-chip skew: %u updates of both chips, avg %u us, max %u us\n",
+              sid.getSkewCount(), sid.getSkewAvgUs(), sid.getSkewMaxUs());
+    }
+    Serial.printf("I2C: %u bytes sent, %u bytes saved by partial updates\n",
+          sid.getBusBytes(), sid.getBusBytesSaved());
+    Serial.printf("Display flushes replaced before start: %u\n", sid.getFlushesSkipped());
+    Serial.printf("LEDs: %u on, est. %u mA; %u flushes current-limited\n",
+          sid.getLitLEDs(), sid.getCurrentMa(), sid.getLimitedFlushes());
+    Serial.printf("I2C errors: 0x74 %u, 0x72 %u; flushes repeated %u; bus recoveries %u\n",
+          sid.getTxErrors(0), sid.getTxErrors(1), sid.getRetries(), sid.getBusRecoveries());
+    Serial.printf("Display RAM scrub: %u words checked, %u repaired, %u read errors\n",
+          sid.getScrubWords(), sid.getScrubRepairs(), sid.getScrubErrors());
+    if(sid.getGrayBits()) {
+        Serial.printf("Grayscale: %d bits, unit %u us, %u Hz\n", 
+              sid.getGrayBits(), sid.getGrayUnitUs(), sid.getGrayRefreshHz());
+    }
+    for(int i = 0; i < LAT_NUM; i++) {
+        histo_print(latNames[i], &latHisto[i], "us");
+    }
+    Serial.printf("Render tick: %u/s while columns move (target %d/s)\n", tickRate, SID_RENDER_HZ);
+    histo_print("Render tick jitter", &tickJitter, "us");
+    Serial.printf("CPU idle: core 0 %d%%, core 1 %d%%\n", cpuIdlePct[0], cpuIdlePct[1]);
+    Serial.printf("Waiting: render task %d%%, receive task %d%%\n", renderIdle.pct, recvIdle.pct);
+    Serial.printf("Log messages dropped: %u\n", log_getDropped());
+}
+
+/*
+ * DMX receive task
+ * 
+ * Waits for packets, validates them and hands the SID footprint
+ * over to dmx_loop(). Never touches the display, so reception 
+ * is never held up by I2C traffic.
+ */
+static void dmxRecvTask(void *pvParameters)
+{
+    bool footprintChanged = false;
+    
+    for(;;) {
+
+        unsigned long startUs = micros();
+        size_t num = dmx_receive_num(dmxPort, &packet, dmxSlotsToReceive, DMX_TIMEOUT_TICK);
+        idleMeterAdd(&recvIdle, startUs, micros());
+
+        // RDM requests are handled inside dmx_receive
+        if(checkDMXFootprint()) {
+            footprintChanged = true;
+        }
+        {
+            bool ident;
+            if(rdm_get_identify_device(dmxPort, &ident) && ident != rdmIdentify) {
+                rdmIdentify = ident;
+                xTaskNotifyGive(renderTaskHandle);
+            }
+        }
+      
+        if(!num) {
+            if(packet.err == DMX_ERR_TIMEOUT) {
+                stats_error(packet.err);
+            }
+            continue;
+        }
+
+        lastDMXpacket = millis();
+        uint32_t rxUs = (uint32_t)esp_timer_get_time();
+
+        stats_packet(packet.size);
+
+        if(packet.err) {
+            stats_error(packet.err);
+            log_printf(LOG_DMX_ERR, "DMX error: %d\n", packet.err);
+            continue;
+        }
+
+        if(packet.size < dmxSlotsToReceive) {
+            stats_reject(STATS_REJ_SHORT);
+            continue;
+        }
+
+        dmx_read(dmxPort, data, packet.size);
+
+        if(data[0]) {
+            stats_reject(STATS_REJ_SC);
+            log_printf(LOG_DMX_SC, "Unrecognized start code %d (0x%02x)\n", data[0], data[0]);
+            continue;
+        }
+
+        #ifdef DMX_USE_VERIFY
+        if(data[DMX_VERIFY_CHANNEL] != DMX_VERIFY_VALUE) {
+            stats_reject(STATS_REJ_VERIFY);
+            log_printf(LOG_DMX_VERIFY, "Bad verification value on channel %d: %d (should be %d)\n", 
+                  DMX_VERIFY_CHANNEL, data[DMX_VERIFY_CHANNEL], DMX_VERIFY_VALUE);
+            continue;
+        }
+        #endif
+
+        sidFrame *frame = dmxFrames.writeBuf();
+        frame->personality = dmxPersonality;
+        frame->numSlots = dmxFootprint;
+        frame->stamp = rxUs;
+        memcpy(frame->slots, data + dmxAddress, dmxFootprint);
+        #if DMX_FILTER_MODE > 0
+        filterFrame(frame->slots, dmxFootprint, footprintChanged);
+        footprintChanged = false;
+        #endif
+        dmxFrames.publish();
+        xTaskNotifyGive(renderTaskHandle);
+    }
+}
+
+#ifdef SID_HAVE_NET
+/*
+ * Art-Net/sACN receive task
+ *
+ * Takes our footprint from the configured universe, at the 
+ * same start address and with the same personality as wired 
+ * DMX. Packets are parsed in the socket receive buffer; only 
+ * the footprint is copied.
+ */
+static void netRecvTask(void *pvParameters)
+{
+    netDMXPacket pkt;
+
+    WiFi.mode(WIFI_STA);
+    WiFi.setSleep(false);
+    WiFi.begin(NET_SSID, NET_PASSWORD);
+    
+    while(WiFi.status() != WL_CONNECTED) {
+        vTaskDelay(pdMS_TO_TICKS(500));
+    }
+
+    Serial.printf("WiFi connected, IP %s\n", WiFi.localIP().toString().c_str());
+
+    if(!netdmx_begin(NET_ARTNET_UNIVERSE, NET_SACN_UNIVERSE)) {
+        Serial.println("Failed to open Art-Net/sACN sockets");
+        vTaskDelete(NULL);
+    }
+    
+    for(;;) {
+
+        if(!netdmx_receive(&pkt, 1000))
+            continue;
+
+        uint16_t addr = dmxAddress;
+        uint8_t  pers = dmxPersonality;
+        uint8_t  footprint = dmxPersonalities[pers - 1].footprint;
+
+        if(addr - 1 + footprint > pkt.numSlots)
+            continue;
+
+        #ifdef DMX_USE_VERIFY
+        if(pkt.numSlots < DMX_VERIFY_CHANNEL || 
+           pkt.slots[DMX_VERIFY_CHANNEL - 1] != DMX_VERIFY_VALUE)
+            continue;
+        #endif
+
+        lastNetPacket = millis();
+
+        sidFrame *frame = netFrames.writeBuf();
+        frame->personality = pers;
+        frame->numSlots = footprint;
+        frame->stamp = (uint32_t)esp_timer_get_time();
+        memcpy(frame->slots, pkt.slots + addr - 1, footprint);
+        netFrames.publish();
+        xTaskNotifyGive(renderTaskHandle);
+    }
+}
+#endif
 
 
 /*********************************************************************************
@@ -416,6 +1228,7 @@ void dmx_loop()
  *********************************************************************************/
 
 /*
+ * Standard personality:
  * 0 = ch1:   Master brightness (0-255; 0=off; 1-255=darkest-brightest) 
  * 1 = ch2:   "Effect ramp up" (0-255); 0=off (use ch3-12); 1=idle ???; 2-255 ramp up to tt
  * 2 = ch3:   Col 1 (left-most) (0-255) |
@@ -428,63 +1241,167 @@ void dmx_loop()
  * 9 = ch10:  Col 8 (0-255)
  * 10 = ch11: Col 9  (0-255)
  * 11 = ch12: Col 10 (right-most) (0-255)
+ *
+ * Compact personality: ch1 and ch2 only. With ch2 at 0, 
+ * the display is blank.
+ *
+ * Extended personality: ch1-ch12 as Standard, plus
+ * 12-21 = ch13-22: Peak dot col 1-10 (0=none; 1-255=bottom-top)
+ * 22 = ch23: Animation speed (0=normal; 1-255=slowest(x0.25)-fastest(x4))
+ * 23 = ch24: Strobe (0-9=off; 10-39/40-69/70-99=0.5/1/2Hz; 100-255=slowest(3)-fastest(25Hz))
+ *
+ * Grayscale personality: ch1-ch12 as Standard, plus
+ * 12-21 = ch13-22: Column intensity col 1-10 (0=off; 1-255=darkest-brightest)
+ *
+ * Text personality: ch1-ch12 as Standard, plus
+ * 12 = ch13: Marquee text (0=off, use ch3-12; 1-255=SID_TEXTS, in equal ranges)
+ * 13 = ch14: Scroll speed (0=SID_TEXT_SPEED; 1-255=slowest(2)-fastest(40 rows/s))
  * 
  */
 
-static bool setDisplay(int base)
+static bool setDisplay(const sidFrame *frame)
 { 
+    const uint8_t *fp = frame->slots;
     bool forceupd = false;
-    int  mbri = data[base + 0];
-    int  eru = data[base + 1];
+    int  mbri = fp[DMX_CH_BRI];
+    int  eru = fp[DMX_CH_ERU];
+
+    latEntryUs = (uint32_t)esp_timer_get_time();
+    latEntryCyc = ESP.getCycleCount();
+    latRxUs = frame->stamp;
+
+    if(frame->personality == SID_PERS_EXTENDED && fp[DMX_CH_SPEED]) {
+        animSpeed = 25 + ((int)fp[DMX_CH_SPEED] * 375 / 255);
+    } else {
+        animSpeed = 100;
+    }
+
+    // Column levels apply to everything shown, including animations
+    if(frame->personality == SID_PERS_GRAY) {
+        for(int i = 0; i < 10; i++) {
+            sid.setColumnLevel(i, fp[DMX_CH_LEVEL + i]);
+        }
+    } else {
+        sid.resetColumnLevels();
+    }
     
     if(mbri) {
         if(eru) {
+            interpActive = false;
+            marqueeActive = false;
+            colShown = false;
             switch(modeOfOperation) {
             case 0:
                 for(int i = 0; i < 10; i++) {
                     sid.drawBarWithHeight(i, staleledseq[efxRanges[eru]][i]);
                 }
-                sid.show();
+                showFrame();
                 break;
             case 1:
             case 2:
                 gpsSpeed = (int)((float)eru / 2.87);
                 if(gpsSpeed > 75) forceupd = true;
-                #ifdef SID_DBG
-                Serial.printf("gpsSpeed %d\n", gpsSpeed);
-                #endif
+                SID_DBGLOG("gpsSpeed %d\n", gpsSpeed);
                 break;
             case 3:
             case 4:
                 gpsSpeed = (int)((float)eru / 4.329) + 30;
                 if(gpsSpeed > 75) forceupd = true;
-                #ifdef SID_DBG
-                Serial.printf("gpsSpeed %d\n", gpsSpeed);
-                #endif
+                SID_DBGLOG("gpsSpeed %d\n", gpsSpeed);
                 break;
             }
+        } else if(frame->personality == SID_PERS_TEXT && fp[DMX_CH_TEXT]) {
+            // marquee; (re)start on text change, first step right away
+            int t = (fp[DMX_CH_TEXT] - 1) * NUM_TEXTS / 255;
+            marqueeStepUs = 1000000 / (fp[DMX_CH_TSPEED] ? 
+                      2 + fp[DMX_CH_TSPEED] * 38 / 255 : SID_TEXT_SPEED);
+            interpActive = false;
+            colShown = false;
+            if(!marqueeActive || t != marqueeText) {
+                sid.marqueeStart(marqueeTexts[t]);
+                sid.marqueeStep();
+                showFrame();
+                marqueeActive = true;
+                marqueeText = t;
+                nextMarqueeUs = micros() + marqueeStepUs;
+            }
+            gpsSpeed = -1;
+            prevGPSSpeed = -2;
         } else {
             // manual pattern selection
-            for(int i = 0; i < 10; i++) {
-                sid.drawBarWithHeight(i, data[base + 2 + i] / 12);
+            marqueeActive = false;
+            if(frame->personality == SID_PERS_COMPACT) {
+                memset(colTarget, 0, sizeof(colTarget));
+                memset(colCur, 0, sizeof(colCur));
+                memset(colDot, 0, sizeof(colDot));
+            } else {
+                for(int i = 0; i < 10; i++) {
+                    colTarget[i] = min(fp[DMX_CH_COL + i] / 12, 20) << 8;
+                    colDot[i] = (frame->personality == SID_PERS_EXTENDED) ? fp[DMX_CH_DOT + i] : 0;
+                }
             }
-            sid.show();
+            // Coming from something else: Start at the heights shown,
+            // taken from the top LED lit in each column
+            if(!colShown) {
+                sidField field;
+                sid.getField(&field);
+                for(int i = 0; i < 10; i++) {
+                    colCur[i] = (field.col[i] ? 32 - __builtin_clz(field.col[i]) : 0) << 8;
+                }
+                colShown = true;
+            }
+            // First step right away, then in render ticks
+            if(!interpActive) {
+                lastTickUs = micros();
+                nextTickUs = lastTickUs + RENDER_TICK_US;
+            }
+            interpActive = renderColumns();
+            showFrame();
             gpsSpeed = -1;
             prevGPSSpeed = -2;
         }
     }
 
-    if(mbri) {    // master bri
+    setStrobe((frame->personality == SID_PERS_EXTENDED) ? fp[DMX_CH_STROBE] : 0);
+
+    // Master brightness: Gamma-corrected and dithered by the display;
+    // fade when switching on or off
+    if(strobeLit) {
         sid.on();
-        sid.setBrightness(mbri / 16);
     } else {
         sid.off();
     }
+    sid.setBrightness(15);
+    sid.setMaster(mbri, (!mbri != !lastMbri) ? SID_FADE_MS : 0);
+    lastMbri = mbri;
 
     return forceupd;
 }
 
 
+// Show a frame decoded by setDisplay(), and record its latency
+static void showFrame()
+{
+    uint32_t mhz = ESP.getCpuFreqMHz();
+    uint32_t queueUs = latEntryUs - latRxUs;
+
+    histo_add(&latHisto[LAT_QUEUE], queueUs);
+    histo_add(&latHisto[LAT_DECODE], (ESP.getCycleCount() - latEntryCyc) / mhz);
+
+    // Tag is the receive time in this core's cycle count
+    sid.show(latEntryCyc - queueUs * mhz);
+}
+
+// Flush callback: A frame from showFrame() has reached the chips
+static void frameFlushed(uint32_t tag, uint32_t ready, uint32_t first, uint32_t second)
+{
+    uint32_t mhz = ESP.getCpuFreqMHz();
+
+    histo_add(&latHisto[LAT_CHIP0], (first - ready) / mhz);
+    histo_add(&latHisto[LAT_CHIP1], (second - first) / mhz);
+    histo_add(&latHisto[LAT_TOTAL], (second - tag) / mhz);
+}
+
 static void showBaseLine(int variation, uint16_t flags)
 {
     const int mods[21][10] = {
@@ -606,7 +1523,7 @@ static void showIdle(bool forceUpdate, bool freezeBaseLine)
 
     if(useGPSS && gpsSpeed >= 0) {
 
-        if(!forceUpdate && (now - lastChange < 500))
+        if(!forceUpdate && (now - lastChange < 500 * 100 / animSpeed))
             return;
 
         usingGPSS = true;
@@ -663,7 +1580,7 @@ static void showIdle(bool forceUpdate, bool freezeBaseLine)
 
     } else {
         
-        if(!forceUpdate && (now - lastChange < idleDelay))
+        if(!forceUpdate && (now - lastChange < idleDelay * 100 / animSpeed))
             return;
           
         lastChange = now;
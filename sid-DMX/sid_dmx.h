@@ -15,6 +15,8 @@ void dmx_boot();
 void dmx_setup();
 void dmx_loop();
 
+void dmx_printStatus();
+
 
 void showWaitSequence();
 void endWaitSequence();
@@ -0,0 +1,100 @@
+/*
+ * -------------------------------------------------------------------
+ * CircuitSetup.us SID - DMX-controlled
+ * (C) 2024 Thomas Winischhofer (A10001986)
+ * All rights reserved.
+ * -------------------------------------------------------------------
+ */
+
+#ifndef _SID_FRAME_H
+#define _SID_FRAME_H
+
+// This file must not depend on Arduino/ESP-IDF headers; the frame
+// handoff is plain C++11 and can be built and exercised on a host.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#define SID_FRAME_SLOTS   24    // Max DMX footprint carried per frame
+
+struct sidFrame {
+    uint32_t seq;                       // Set by publish()
+    uint32_t stamp;                     // Receive time (us), set by producer
+    uint8_t  personality;               // Defines meaning and number of slots
+    uint8_t  numSlots;
+    uint8_t  slots[SID_FRAME_SLOTS];    // Footprint, starting at start address
+};
+
+/*
+ * Single-producer/single-consumer handoff, newest frame wins.
+ * T must have a uint32_t seq member.
+ *
+ * The producer always has a private buffer to fill, the consumer
+ * always has a private buffer to read. A third buffer holds the
+ * most recently published frame. publish() and acquire() merely swap
+ * buffer indices with one atomic exchange, so neither side ever waits
+ * for the other, and a frame the consumer holds can never be written
+ * to while it is being read (no torn frames).
+ * If the producer publishes again before the consumer picked up the
+ * previous frame, the previous frame is dropped.
+ */
+template<class T> class sidHandoff {
+
+    public:
+
+        // Producer: Buffer to fill
+        T *writeBuf()
+        {
+            return &_buf[_prod];
+        }
+
+        // Producer: Make the buffer from writeBuf() the latest frame
+        void publish()
+        {
+            _buf[_prod].seq = ++_seq;
+            _prod = _latest.exchange(_prod | SFH_NEW, std::memory_order_acq_rel) & SFH_IDX;
+        }
+
+        // Consumer: Newest frame, or NULL if nothing was published since
+        // the last call. The frame stays valid until the next call.
+        const T *acquire()
+        {
+            if(!(_latest.load(std::memory_order_relaxed) & SFH_NEW))
+                return NULL;
+            _cons = _latest.exchange(_cons, std::memory_order_acq_rel) & SFH_IDX;
+            _skipped += _buf[_cons].seq - _lastSeq - 1;
+            _lastSeq = _buf[_cons].seq;
+            return &_buf[_cons];
+        }
+
+        // Consumer: True if a frame was published since the last
+        // acquire()
+        bool pending()
+        {
+            return _latest.load(std::memory_order_relaxed) & SFH_NEW;
+        }
+
+        // Consumer: Number of frames dropped because a newer one 
+        // was published before they were acquired
+        uint32_t getSkipped()
+        {
+            return _skipped;
+        }
+
+    private:
+        static const uint8_t SFH_IDX = 0x03;
+        static const uint8_t SFH_NEW = 0x04;
+
+        T        _buf[3];
+        uint8_t  _prod = 0;     // Owned by producer
+        uint8_t  _cons = 1;     // Owned by consumer
+        uint32_t _lastSeq = 0;  // Owned by consumer
+        uint32_t _skipped = 0;  // Owned by consumer
+        uint32_t _seq = 0;      // Owned by producer
+        std::atomic<uint8_t> _latest{2};
+};
+
+typedef sidHandoff<sidFrame> sidFrameHandoff;
+
+#endif
@@ -30,6 +30,70 @@
 // QLC+ version 4.x)
 //#define DMX_USE_VERIFY
 
+// Temporal filter against corrupt DMX frames; an alternative to
+// DMX_USE_VERIFY which does not hinder "black out". Costs latency:
+// 0: Off
+// 1: Each channel is the median of its last 3 values (1 frame 
+//    latency on changes)
+// 2: A channel change larger than DMX_FILTER_DELTA must persist 
+//    for DMX_FILTER_FRAMES frames before it is shown 
+//    (DMX_FILTER_FRAMES - 1 frames latency on large changes)
+#define DMX_FILTER_MODE    0
+#define DMX_FILTER_FRAMES  2
+#define DMX_FILTER_DELTA   12
+
+// If this is uncommented, the firmware additionally accepts Art-Net
+// and sACN (E1.31) data through WiFi. The footprint is taken from 
+// the configured universe at the same start address as for wired
+// DMX. While wired DMX is connected, it takes precedence.
+//#define SID_HAVE_NET
+#define NET_SSID             ""
+#define NET_PASSWORD         ""
+#define NET_ARTNET_UNIVERSE  0    // Art-Net Port-Address (0-32767)
+#define NET_SACN_UNIVERSE    1    // sACN universe (1-63999)
+
+// If this is uncommented, display updates are sent to the chips by
+// a separate task, so rendering never waits for I2C. A frame not
+// yet sent is replaced by a newer one.
+#define SID_FLUSH_ASYNC
+
+// In manual mode, column heights move towards new DMX values at
+// no more than SID_SLEW_RATE LEDs per second (0 = jump), drawn
+// by a render tick running at SID_RENDER_HZ while columns move.
+#define SID_RENDER_HZ      125
+#define SID_SLEW_RATE      200
+
+// Fade time (ms) when the master brightness channel goes from 0
+// to non-zero or vice versa. Other changes are shown immediately.
+// Fades and the dithering between the chips' 16 dim levels need
+// SID_FLUSH_ASYNC; without it, master brightness jumps to the 
+// nearest dim level.
+#define SID_FADE_MS        250
+
+// Grayscale for personality "SID Grayscale" (needs SID_FLUSH_ASYNC): 
+// Number of bit planes (1-6) per column. More planes give finer
+// steps but a lower refresh rate, as each plane is an I2C transfer.
+// 0 chooses the most planes that still refresh at 100Hz.
+#define SID_GRAY_BITS      0
+
+// Texts for personality "SID Text", selected by DMX. Available
+// characters are 0-9, A-Z and . & * # ^ $ < > ~; others show as 
+// a blank. SID_TEXT_SPEED is the default scroll speed (rows/s).
+#define SID_TEXTS          "OUTATIME", "88 MPH", "1.21 GIGAWATTS", "TIME CIRCUITS ON"
+#define SID_TEXT_SPEED     10
+
+// Bus time (us per second) for reading back the display RAM and 
+// repairing LEDs that a disturbed I2C transfer left wrong; 0 = off
+// (needs SID_FLUSH_ASYNC).
+#define SID_SCRUB_BUDGET   2000
+
+// Current limiter for battery powered props: Brightness is lowered
+// when the estimated LED current exceeds SID_CURRENT_BUDGET (mA; 0 
+// = no limit). SID_LED_CURRENT is the current of one LED at full 
+// brightness (mA); measure with all LEDs on and divide by 200.
+#define SID_CURRENT_BUDGET 0
+#define SID_LED_CURRENT    5
+
 // Mode for "Effect ramp up" slider at DMX values 1 through 255:
 // 0: slider goes through strict tt sequence (51 steps, stale)
 // 1: slider works like GPS speed on original firmware 
@@ -0,0 +1,150 @@
+/*
+ * -------------------------------------------------------------------
+ * CircuitSetup.us SID - DMX-controlled
+ * (C) 2024 Thomas Winischhofer (A10001986)
+ * All rights reserved.
+ * -------------------------------------------------------------------
+ */
+
+#include "sid_global.h"
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "sid_log.h"
+#include "sid_dmx.h"
+
+/*
+ * Log messages are put in a lock-free ring buffer (bounded
+ * multi-producer/single-consumer queue) and printed by a low
+ * priority task. Formatting happens in that task as well, so
+ * logging costs the caller only a few atomic operations and
+ * never waits for Serial.
+ * fmt must be a string literal, it is used after log_printf()
+ * returned.
+ * The log task also owns Serial input: Sending 's' prints 
+ * statistics.
+ */
+
+#define LOG_RING_SIZE   32      // Must be a power of 2
+#define LOG_TASK_STACK  3072
+#define LOG_TASK_PRIO   1
+#define LOG_TASK_DELAY  20      // ms between drain runs
+
+struct logEntry {
+    std::atomic<uint32_t> seq;
+    const char *fmt;
+    uint8_t     type;
+    uint32_t    suppressed;     // Messages of this type dropped by rate limit
+    int32_t     args[3];
+};
+
+static logEntry              logRing[LOG_RING_SIZE];
+static std::atomic<uint32_t> logHead(0);
+static uint32_t              logTail = 0;       // Owned by log task
+static std::atomic<uint32_t> logDropped(0);     // Ring full
+
+// Minimum interval between messages of one type (ms; 0 = no limit)
+static const uint16_t logInterval[LOG_NUM_TYPES] = {
+    0,      // LOG_INFO
+    1000,   // LOG_DMX_ERR
+    1000,   // LOG_DMX_SC
+    1000,   // LOG_DMX_VERIFY
+    0       // LOG_DBG
+};
+
+static std::atomic<uint32_t> logCount[LOG_NUM_TYPES];
+static std::atomic<uint32_t> logSuppressed[LOG_NUM_TYPES];
+static std::atomic<uint32_t> logLast[LOG_NUM_TYPES];
+
+static void logTask(void *pvParameters);
+
+void log_setup()
+{
+    for(int i = 0; i < LOG_RING_SIZE; i++) {
+        logRing[i].seq.store(i, std::memory_order_relaxed);
+    }
+    for(int i = 0; i < LOG_NUM_TYPES; i++) {
+        logCount[i].store(0, std::memory_order_relaxed);
+        logSuppressed[i].store(0, std::memory_order_relaxed);
+        logLast[i].store(millis() - 0x10000, std::memory_order_relaxed);
+    }
+
+    xTaskCreate(logTask, "log", LOG_TASK_STACK, NULL, LOG_TASK_PRIO, NULL);
+}
+
+void log_printf(uint8_t type, const char *fmt, int32_t a, int32_t b, int32_t c)
+{
+    uint32_t pos, now, last;
+    logEntry *e;
+
+    logCount[type].fetch_add(1, std::memory_order_relaxed);
+
+    if(logInterval[type]) {
+        now = millis();
+        last = logLast[type].load(std::memory_order_relaxed);
+        if(now - last < logInterval[type] ||
+           !logLast[type].compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+            logSuppressed[type].fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    pos = logHead.load(std::memory_order_relaxed);
+    for(;;) {
+        e = &logRing[pos & (LOG_RING_SIZE - 1)];
+        int32_t dif = (int32_t)(e->seq.load(std::memory_order_acquire) - pos);
+        if(!dif) {
+            if(logHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if(dif < 0) {
+            logDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = logHead.load(std::memory_order_relaxed);
+        }
+    }
+
+    e->fmt = fmt;
+    e->type = type;
+    e->suppressed = logSuppressed[type].exchange(0, std::memory_order_relaxed);
+    e->args[0] = a;
+    e->args[1] = b;
+    e->args[2] = c;
+    e->seq.store(pos + 1, std::memory_order_release);
+}
+
+// Number of messages of a type, including suppressed ones
+uint32_t log_getCount(uint8_t type)
+{
+    return logCount[type].load(std::memory_order_relaxed);
+}
+
+uint32_t log_getDropped()
+{
+    return logDropped.load(std::memory_order_relaxed);
+}
+
+static void logTask(void *pvParameters)
+{
+    for(;;) {
+
+        logEntry *e = &logRing[logTail & (LOG_RING_SIZE - 1)];
+
+        if((int32_t)(e->seq.load(std::memory_order_acquire) - (logTail + 1)) < 0) {
+            if(Serial.available() && Serial.read() == 's') {
+                dmx_printStatus();
+            }
+            vTaskDelay(pdMS_TO_TICKS(LOG_TASK_DELAY));
+            continue;
+        }
+
+        if(e->suppressed) {
+            Serial.printf("(%u similar messages suppressed)\n", e->suppressed);
+        }
+        Serial.printf(e->fmt, e->args[0], e->args[1], e->args[2]);
+
+        e->seq.store(logTail + LOG_RING_SIZE, std::memory_order_release);
+        logTail++;
+    }
+}
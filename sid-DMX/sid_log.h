@@ -0,0 +1,32 @@
+/*
+ * -------------------------------------------------------------------
+ * CircuitSetup.us SID - DMX-controlled
+ * (C) 2024 Thomas Winischhofer (A10001986)
+ * All rights reserved.
+ * -------------------------------------------------------------------
+ */
+
+#ifndef _SID_LOG_H
+#define _SID_LOG_H
+
+// Message types; each has its own rate limit and counter
+#define LOG_INFO          0   // Status messages, not rate limited
+#define LOG_DMX_ERR       1   // DMX driver error
+#define LOG_DMX_SC        2   // Unrecognized start code
+#define LOG_DMX_VERIFY    3   // Bad verification value
+#define LOG_DBG           4   // Debug output (SID_DBG only)
+#define LOG_NUM_TYPES     5
+
+void     log_setup();
+void     log_printf(uint8_t type, const char *fmt, int32_t a = 0, int32_t b = 0, int32_t c = 0);
+uint32_t log_getCount(uint8_t type);
+uint32_t log_getDropped();
+
+// Debug output; compiles to nothing unless SID_DBG is defined
+#ifdef SID_DBG
+#define SID_DBGLOG(...) log_printf(LOG_DBG, __VA_ARGS__)
+#else
+#define SID_DBGLOG(...) do { } while(0)
+#endif
+
+#endif
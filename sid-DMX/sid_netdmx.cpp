@@ -0,0 +1,239 @@
+/*
+ * -------------------------------------------------------------------
+ * CircuitSetup.us SID - DMX-controlled
+ * (C) 2024 Thomas Winischhofer (A10001986)
+ * All rights reserved.
+ * -------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#ifdef ESP_PLATFORM
+#include <lwip/sockets.h>
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "sid_netdmx.h"
+
+// Largest packet we care about: sACN header + start code + 512 slots
+#define NETDMX_BUF_SIZE  (126 + 512)
+
+static uint8_t  rxBuf[NETDMX_BUF_SIZE];
+
+static int      artnetSock = -1;
+static int      sacnSock = -1;
+static uint16_t artnetUni = 0;
+static uint16_t sacnUni = 1;
+static uint8_t  lastSACNSeq = 0;
+static bool     haveSACNSeq = false;
+
+static const uint8_t artnetID[8] = { 'A', 'r', 't', '-', 'N', 'e', 't', 0 };
+static const uint8_t sacnID[12] = { 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+
+static inline uint16_t get16be(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t get32be(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/*
+ * ArtDmx:
+ *  0: "Art-Net\0", 8: OpCode 0x5000 (LE), 10: ProtVer (BE, >= 14),
+ * 12: Sequence, 13: Physical, 14: SubUni, 15: Net, 16: Length (BE),
+ * 18: Data (no start code)
+ */
+static uint8_t parseArtnet(const uint8_t *buf, size_t len, netDMXPacket *pkt)
+{
+    uint16_t num;
+
+    if(len < 18 || memcmp(buf, artnetID, 8))
+        return NETDMX_NONE;
+
+    if(buf[8] != 0x00 || buf[9] != 0x50 || get16be(buf + 10) < 14)
+        return NETDMX_NONE;
+
+    num = get16be(buf + 16);
+    if(num > 512 || (size_t)(18 + num) > len)
+        return NETDMX_NONE;
+
+    pkt->proto = NETDMX_ARTNET;
+    pkt->sequence = buf[12];
+    pkt->universe = ((buf[15] & 0x7f) << 8) | buf[14];
+    pkt->numSlots = num;
+    pkt->slots = buf + 18;
+
+    return NETDMX_ARTNET;
+}
+
+/*
+ * E1.31 data packet:
+ * Root layer:    0: Preamble 0x0010, 2: Postamble 0, 4: "ASC-E1.17\0\0\0",
+ *               16: Flags/Length, 18: Vector 0x00000004, 22: CID
+ * Framing layer: 38: Flags/Length, 40: Vector 0x00000002, 44: Source name,
+ *               108: Priority, 109: Sync addr, 111: Sequence, 112: Options,
+ *               113: Universe
+ * DMP layer:    115: Flags/Length, 117: Vector 0x02, 118: Type 0xa1,
+ *               119: First addr 0, 121: Increment 1, 123: Count (incl.
+ *               start code), 125: Start code, 126: Data
+ */
+static uint8_t parseSACN(const uint8_t *buf, size_t len, netDMXPacket *pkt)
+{
+    uint16_t num;
+
+    if(len < 126 || get16be(buf) != 0x0010 || memcmp(buf + 4, sacnID, 12))
+        return NETDMX_NONE;
+
+    if(get32be(buf + 18) != 0x00000004 || get32be(buf + 40) != 0x00000002)
+        return NETDMX_NONE;
+
+    if(buf[117] != 0x02 || buf[118] != 0xa1)
+        return NETDMX_NONE;
+
+    // Preview data and stream termination carry no valid levels
+    if(buf[112] & 0x60)
+        return NETDMX_NONE;
+
+    num = get16be(buf + 123);
+    if(num < 1 || num > 513 || (size_t)(125 + num) > len)
+        return NETDMX_NONE;
+
+    // Non-zero start codes are not DMX levels
+    if(buf[125])
+        return NETDMX_NONE;
+
+    pkt->proto = NETDMX_SACN;
+    pkt->sequence = buf[111];
+    pkt->universe = get16be(buf + 113);
+    pkt->numSlots = num - 1;
+    pkt->slots = buf + 126;
+
+    return NETDMX_SACN;
+}
+
+/*
+ * Parse Art-Net/sACN DMX data packet in place.
+ * Returns protocol, or NETDMX_NONE if this is not a DMX data
+ * packet. pkt->slots points into buf; nothing is copied.
+ */
+uint8_t netdmx_parse(const uint8_t *buf, size_t len, netDMXPacket *pkt)
+{
+    if(len >= 8 && buf[0] == 'A') {
+        return parseArtnet(buf, len, pkt);
+    }
+    return parseSACN(buf, len, pkt);
+}
+
+static int openSocket(uint16_t port)
+{
+    struct sockaddr_in addr;
+    int s, on = 1;
+
+    if((s = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        return -1;
+
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if(bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(s);
+        return -1;
+    }
+
+    return s;
+}
+
+/*
+ * Open Art-Net and sACN sockets; join the sACN multicast group
+ * of our universe (239.255.<hi>.<lo>).
+ */
+bool netdmx_begin(uint16_t artnetUniverse, uint16_t sacnUniverse)
+{
+    struct ip_mreq mreq;
+
+    artnetUni = artnetUniverse;
+    sacnUni = sacnUniverse;
+
+    artnetSock = openSocket(NETDMX_ARTNET_PORT);
+    sacnSock = openSocket(NETDMX_SACN_PORT);
+
+    if(sacnSock >= 0) {
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_multiaddr.s_addr = htonl(0xefff0000 | sacnUni);
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        setsockopt(sacnSock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+
+    return (artnetSock >= 0 || sacnSock >= 0);
+}
+
+/*
+ * Wait up to timeoutMs for a DMX data packet for our universe.
+ * pkt->slots remains valid until the next call.
+ */
+bool netdmx_receive(netDMXPacket *pkt, int timeoutMs)
+{
+    struct timeval tv;
+    fd_set fds;
+    int maxfd = -1, socks[2] = { artnetSock, sacnSock };
+
+    FD_ZERO(&fds);
+    for(int i = 0; i < 2; i++) {
+        if(socks[i] >= 0) {
+            FD_SET(socks[i], &fds);
+            if(socks[i] > maxfd) maxfd = socks[i];
+        }
+    }
+    if(maxfd < 0)
+        return false;
+
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+
+    if(select(maxfd + 1, &fds, NULL, NULL, &tv) <= 0)
+        return false;
+
+    for(int i = 0; i < 2; i++) {
+
+        int len;
+
+        if(socks[i] < 0 || !FD_ISSET(socks[i], &fds))
+            continue;
+
+        if((len = recv(socks[i], rxBuf, sizeof(rxBuf), 0)) <= 0)
+            continue;
+
+        switch(netdmx_parse(rxBuf, len, pkt)) {
+        case NETDMX_ARTNET:
+            if(pkt->universe == artnetUni) {
+                return true;
+            }
+            break;
+        case NETDMX_SACN:
+            if(pkt->universe == sacnUni) {
+                // E1.31 6.7.2: Discard out-of-order packets
+                int8_t diff = (int8_t)(pkt->sequence - lastSACNSeq);
+                if(haveSACNSeq && diff <= 0 && diff > -20)
+                    break;
+                lastSACNSeq = pkt->sequence;
+                haveSACNSeq = true;
+                return true;
+            }
+            break;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,38 @@
+/*
+ * -------------------------------------------------------------------
+ * CircuitSetup.us SID - DMX-controlled
+ * (C) 2024 Thomas Winischhofer (A10001986)
+ * All rights reserved.
+ * -------------------------------------------------------------------
+ */
+
+#ifndef _SID_NETDMX_H
+#define _SID_NETDMX_H
+
+// Art-Net/sACN (E1.31) receiver. Only uses BSD sockets, so it
+// builds both on the ESP32 (lwIP) and on a Linux host.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NETDMX_ARTNET_PORT  6454
+#define NETDMX_SACN_PORT    5568
+
+#define NETDMX_NONE    0
+#define NETDMX_ARTNET  1
+#define NETDMX_SACN    2
+
+struct netDMXPacket {
+    uint8_t        proto;       // NETDMX_ARTNET or NETDMX_SACN
+    uint8_t        sequence;    // 0 = sequence not used
+    uint16_t       universe;
+    uint16_t       numSlots;    // Number of DMX slots, excluding start code
+    const uint8_t *slots;       // slots[0] is channel 1; points into packet
+};
+
+uint8_t netdmx_parse(const uint8_t *buf, size_t len, netDMXPacket *pkt);
+
+bool netdmx_begin(uint16_t artnetUniverse, uint16_t sacnUniverse);
+bool netdmx_receive(netDMXPacket *pkt, int timeoutMs);
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * -------------------------------------------------------------------
+ * CircuitSetup.us SID - DMX-controlled
+ * (C) 2024 Thomas Winischhofer (A10001986)
+ * All rights reserved.
+ * -------------------------------------------------------------------
+ */
+
+#include "sid_global.h"
+
+#include <Arduino.h>
+#include <esp_dmx.h>
+#include <atomic>
+
+#include "sid_stats.h"
+
+/*
+ * DMX link statistics
+ *
+ * Written by the DMX receive task only. Readers take a snapshot
+ * through a sequence lock: The writer makes the sequence number
+ * odd while updating, readers retry if it was odd or changed
+ * while they copied. The writer never waits.
+ */
+
+static sidDMXStats           dmxStats;
+static std::atomic<uint32_t> statsSeq(0);
+
+static unsigned long ppsStart = 0;
+static uint32_t      ppsCount = 0;
+static unsigned long lastPacketUs = 0;
+static bool          havePacket = false;
+
+void histo_reset(sidHisto *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void histo_add(sidHisto *h, uint32_t val)
+{
+    int b = val ? 32 - __builtin_clz(val) : 0;
+
+    if(b >= HISTO_BUCKETS) b = HISTO_BUCKETS - 1;
+
+    if(!h->count || val < h->min) h->min = val;
+    if(val > h->max) h->max = val;
+    h->bucket[b]++;
+    h->count++;
+    h->sum += val;
+}
+
+uint32_t histo_avg(const sidHisto *h)
+{
+    return h->count ? (uint32_t)(h->sum / h->count) : 0;
+}
+
+// Upper bound of the bucket holding the given percentile
+uint32_t histo_percentile(const sidHisto *h, int pct)
+{
+    uint32_t need = (uint32_t)(((uint64_t)h->count * pct + 99) / 100);
+    uint32_t cnt = 0;
+
+    if(!h->count)
+        return 0;
+
+    for(int i = 0; i < HISTO_BUCKETS; i++) {
+        cnt += h->bucket[i];
+        if(cnt >= need) {
+            uint32_t ub = i ? ((1UL << i) - 1) : 0;
+            return (ub < h->max) ? ub : h->max;
+        }
+    }
+    return h->max;
+}
+
+void histo_print(const char *name, const sidHisto *h, const char *unit)
+{
+    Serial.printf("%s: n %u, min %u, avg %u, p99 <= %u, max %u %s\n", name,
+          h->count, h->min, histo_avg(h), histo_percentile(h, 99),
+          h->max, unit);
+}
+
+static inline void statsBeginUpdate()
+{
+    statsSeq.store(statsSeq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+static inline void statsEndUpdate()
+{
+    statsSeq.store(statsSeq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Packet received (good or bad)
+void stats_packet(size_t size)
+{
+    unsigned long nowUs = micros();
+    unsigned long now = millis();
+    int b = size ? 32 - __builtin_clz(size) : 0;
+
+    if(b >= STATS_SIZE_BUCKETS) b = STATS_SIZE_BUCKETS - 1;
+
+    statsBeginUpdate();
+
+    dmxStats.packets++;
+    dmxStats.sizes[b]++;
+
+    if(havePacket) {
+        histo_add(&dmxStats.interval, nowUs - lastPacketUs);
+    }
+    lastPacketUs = nowUs;
+    havePacket = true;
+
+    ppsCount++;
+    if(now - ppsStart >= 1000) {
+        dmxStats.pps = (now - ppsStart > 2000) ? 0 : ppsCount;
+        ppsStart = now;
+        ppsCount = 0;
+    }
+
+    statsEndUpdate();
+}
+
+void stats_error(int err)
+{
+    int e;
+
+    switch(err) {
+    case DMX_ERR_TIMEOUT:
+        e = STATS_ERR_TIMEOUT;
+        break;
+    case DMX_ERR_IMPROPER_SLOT:
+        e = STATS_ERR_SLOT;
+        break;
+    case DMX_ERR_UART_OVERFLOW:
+        e = STATS_ERR_OVERFLOW;
+        break;
+    case DMX_ERR_NOT_ENOUGH_SLOTS:
+        e = STATS_ERR_SIZE;
+        break;
+    default:
+        e = STATS_ERR_OTHER;
+    }
+
+    // A timeout means the line is idle, don't report stale pps
+    statsBeginUpdate();
+    dmxStats.errors[e]++;
+    if(e == STATS_ERR_TIMEOUT) {
+        dmxStats.pps = 0;
+        havePacket = false;
+    }
+    statsEndUpdate();
+}
+
+void stats_reject(int why)
+{
+    statsBeginUpdate();
+    dmxStats.rejects[why]++;
+    statsEndUpdate();
+}
+
+void stats_filtered(uint32_t num)
+{
+    statsBeginUpdate();
+    dmxStats.filtered += num;
+    statsEndUpdate();
+}
+
+void stats_get(sidDMXStats *st)
+{
+    uint32_t s1, s2;
+
+    do {
+        s1 = statsSeq.load(std::memory_order_acquire);
+        memcpy(st, (const void *)&dmxStats, sizeof(*st));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        s2 = statsSeq.load(std::memory_order_relaxed);
+    } while((s1 & 1) || s1 != s2);
+}
+
+void stats_print()
+{
+    static const char *errNames[STATS_NUM_ERR] = {
+        "timeout", "improper slot", "overflow", "not enough slots", "other"
+    };
+    sidDMXStats st;
+
+    stats_get(&st);
+
+    Serial.printf("DMX: %u packets, %u/s\n", st.packets, st.pps);
+    Serial.printf("DMX errors:");
+    for(int i = 0; i < STATS_NUM_ERR; i++) {
+        Serial.printf(" %s %u;", errNames[i], st.errors[i]);
+    }
+    Serial.printf("\nDMX rejects: start code %u; verify %u; short %u\n",
+          st.rejects[STATS_REJ_SC], st.rejects[STATS_REJ_VERIFY], st.rejects[STATS_REJ_SHORT]);
+    Serial.printf("DMX values filtered: %u\n", st.filtered);
+    Serial.printf("DMX packet sizes:");
+    for(int i = 0; i < STATS_SIZE_BUCKETS; i++) {
+        if(st.sizes[i]) {
+            Serial.printf(" <%d: %u;", 1 << i, st.sizes[i]);
+        }
+    }
+    Serial.println();
+    histo_print("DMX packet interval", &st.interval, "us");
+}
@@ -0,0 +1,68 @@
+/*
+ * -------------------------------------------------------------------
+ * CircuitSetup.us SID - DMX-controlled
+ * (C) 2024 Thomas Winischhofer (A10001986)
+ * All rights reserved.
+ * -------------------------------------------------------------------
+ */
+
+#ifndef _SID_STATS_H
+#define _SID_STATS_H
+
+/*
+ * Log2-bucketed histogram: Bucket n counts values from 2^(n-1)
+ * to 2^n - 1 (bucket 0 counts zeros). O(1) per sample.
+ */
+#define HISTO_BUCKETS 32
+
+struct sidHisto {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t bucket[HISTO_BUCKETS];
+};
+
+void     histo_reset(sidHisto *h);
+void     histo_add(sidHisto *h, uint32_t val);
+uint32_t histo_avg(const sidHisto *h);
+uint32_t histo_percentile(const sidHisto *h, int pct);
+void     histo_print(const char *name, const sidHisto *h, const char *unit);
+
+// DMX receive errors (packet.err)
+#define STATS_ERR_TIMEOUT   0
+#define STATS_ERR_SLOT      1   // Improper slot
+#define STATS_ERR_OVERFLOW  2   // UART overflow
+#define STATS_ERR_SIZE      3   // Not enough slots
+#define STATS_ERR_OTHER     4
+#define STATS_NUM_ERR       5
+
+// Packets rejected after reception
+#define STATS_REJ_SC        0   // Start code not 0
+#define STATS_REJ_VERIFY    1   // Bad verification value
+#define STATS_REJ_SHORT     2   // Footprint not in packet
+#define STATS_NUM_REJ       3
+
+#define STATS_SIZE_BUCKETS  11  // Log2 buckets of packet size, up to 513
+
+struct sidDMXStats {
+    uint32_t packets;           // All packets, including bad ones
+    uint32_t pps;               // Packets during last full second
+    uint32_t errors[STATS_NUM_ERR];
+    uint32_t rejects[STATS_NUM_REJ];
+    uint32_t sizes[STATS_SIZE_BUCKETS];
+    uint32_t filtered;          // Channel values held back by filter
+    sidHisto interval;          // Inter-arrival time (us)
+};
+
+// Receive task only
+void stats_packet(size_t size);
+void stats_error(int err);
+void stats_reject(int why);
+void stats_filtered(uint32_t num);
+
+// Any task; does not stop the receive task
+void stats_get(sidDMXStats *st);
+void stats_print();
+
+#endif
@@ -15,7 +15,7 @@
 
 #include "sid_font.h"
 
-static const uint16_t translator[10][20][2] =
+static constexpr uint16_t translator[10][20][2] =
 { 
     { 
         { 8+2, 1<<3 },    // bar 0, top most LED   { index in buffer [0-7 chip1, 8-15 chip2], bitmask }
@@ -239,16 +239,255 @@ static const uint16_t translator[10][20][2] =
     }   
 };
 
+/*
+ * Bar masks
+ *
+ * A bar's lower 16 LEDs are all bits of word <bar> (bit 0 = bottom),
+ * its upper 4 LEDs are a nibble in word 10 + (bar % 6): Bits 0-3 
+ * for bars 0-5, bits 4-7 for bars 6-9.
+ * barMasks[bar][height] holds the bits lit in both words for a bar
+ * of this height (0-20). A bar from bottom to top (inclusive) is 
+ * barMasks[top + 1] & ~barMasks[bottom].
+ */
+struct sdBarMask {
+    uint16_t lo;
+    uint16_t hi;
+};
+
+static constexpr int barLoWord(int bar) { return bar; }
+static constexpr int barHiWord(int bar) { return 10 + (bar % 6); }
+static constexpr int barHiShift(int bar) { return (bar < 6) ? 0 : 4; }
+
+static constexpr uint16_t barLoMask(int h)
+{
+    return (h >= 16) ? 0xffff : (uint16_t)((1U << h) - 1);
+}
+
+static constexpr uint16_t barHiMask(int bar, int h)
+{
+    return (h <= 16) ? 0 : (uint16_t)(((1U << (h - 16)) - 1) << barHiShift(bar));
+}
+
+#define BM(b, h) { barLoMask(h), barHiMask(b, h) }
+#define BM_BAR(b) { \
+    BM(b, 0),  BM(b, 1),  BM(b, 2),  BM(b, 3),  BM(b, 4),  BM(b, 5),  BM(b, 6),  \
+    BM(b, 7),  BM(b, 8),  BM(b, 9),  BM(b, 10), BM(b, 11), BM(b, 12), BM(b, 13), \
+    BM(b, 14), BM(b, 15), BM(b, 16), BM(b, 17), BM(b, 18), BM(b, 19), BM(b, 20) }
+
+static constexpr sdBarMask barMasks[10][21] = {
+    BM_BAR(0), BM_BAR(1), BM_BAR(2), BM_BAR(3), BM_BAR(4),
+    BM_BAR(5), BM_BAR(6), BM_BAR(7), BM_BAR(8), BM_BAR(9)
+};
+
+#undef BM_BAR
+#undef BM
+
+// Check barMasks against translator, bit for bit, for all bars 
+// and heights at compile time
+static constexpr uint16_t trMask(int bar, int h, int word, int led = 0)
+{
+    return (led >= h) ? 0 :
+        (((translator[bar][19 - led][0] == word) ? translator[bar][19 - led][1] : 0) |
+         trMask(bar, h, word, led + 1));
+}
+
+static constexpr int trOther(int bar, int h, int led = 0)
+{
+    return (led >= h) ? 0 :
+        (((translator[bar][19 - led][0] != barLoWord(bar) &&
+           translator[bar][19 - led][0] != barHiWord(bar)) ? 1 : 0) +
+         trOther(bar, h, led + 1));
+}
+
+static constexpr bool barMasksOK(int bar = 0, int h = 0)
+{
+    return (bar >= 10) ? true :
+           (h > 20) ? barMasksOK(bar + 1, 0) :
+           (trMask(bar, h, barLoWord(bar)) == barMasks[bar][h].lo &&
+            trMask(bar, h, barHiWord(bar)) == barMasks[bar][h].hi &&
+            !trOther(bar, h) &&
+            barMasksOK(bar, h + 1));
+}
+
+static_assert(barMasksOK(), "barMasks do not match translator");
+
+// Bits of each RAM word that drive an LED
+static constexpr uint16_t ledWordMask(int word, int bar = 0)
+{
+    return (bar >= 10) ? 0 :
+        (((barLoWord(bar) == word) ? barMasks[bar][20].lo : 0) |
+         ((barHiWord(bar) == word) ? barMasks[bar][20].hi : 0) |
+         ledWordMask(word, bar + 1));
+}
+
+#define LM4(w)  ledWordMask(w), ledWordMask(w + 1), ledWordMask(w + 2), ledWordMask(w + 3)
+
+static constexpr uint16_t ledMask[SD_BUF_SIZE] = {
+    LM4(0), LM4(4), LM4(8), LM4(12)
+};
+
+#undef LM4
+
+static constexpr int ledCount(int word = 0)
+{
+    return (word >= SD_BUF_SIZE) ? 0 : 
+        __builtin_popcount(ledMask[word]) + ledCount(word + 1);
+}
+
+static_assert(ledCount() == SD_FIELD_COLS * SD_FIELD_ROWS, "ledMask is off");
+
+/*
+ * Gamma table for the master dimmer
+ *
+ * Maps a level (0-255) to LED duty cycle in 1/4096 with gamma 2.2
+ * (x^2 * x^0.2; the fifth root by Newton iteration, since pow() 
+ * is not constexpr).
+ */
+static constexpr double root5(double x, double r = 1.0, int n = 40)
+{
+    return n ? root5(x, (4.0 * r + x / (r * r * r * r)) / 5.0, n - 1) : r;
+}
+
+static constexpr uint16_t gammaRaw(int i)
+{
+    return (uint16_t)((double)i / 255.0 * i / 255.0 * root5(i / 255.0) * SD_DUTY_FULL + 0.5);
+}
+
+// Any level above 0 gives some light
+static constexpr uint16_t gammaDuty(int i)
+{
+    return (i && !gammaRaw(i)) ? 1 : gammaRaw(i);
+}
+
+#define GD4(i)   gammaDuty(i), gammaDuty(i + 1), gammaDuty(i + 2), gammaDuty(i + 3)
+#define GD16(i)  GD4(i), GD4(i + 4), GD4(i + 8), GD4(i + 12)
+#define GD64(i)  GD16(i), GD16(i + 16), GD16(i + 32), GD16(i + 48)
+
+static constexpr uint16_t gammaTable[256] = {
+    GD64(0), GD64(64), GD64(128), GD64(192)
+};
+
+#undef GD64
+#undef GD16
+#undef GD4
+
+static_assert(gammaTable[0] == 0 && gammaTable[1] && gammaTable[255] == SD_DUTY_FULL &&
+              gammaTable[128] > 850 && gammaTable[128] < 950, 
+              "gammaTable is off");
+
+/*
+ * Glyph cache
+ *
+ * The fonts are stored row by row, MSB left. For drawing, every 
+ * glyph is turned into column words once (bit 0 = bottom row), the 
+ * layout sidField uses, so a glyph is placed with one shift per 
+ * column. Characters are looked up by code; SD_NO_GLYPH marks 
+ * characters the font does not have.
+ */
+#define SD_NO_GLYPH   0xff
+#define SD_NUM_GLYPHS  (int)(sizeof(alphaChars) / sizeof(alphaChars[0]))
+#define SD_NUM_GLYPHS8 (int)(sizeof(alphaChars8) / sizeof(alphaChars8[0]))
+
+static uint8_t  glyphIdx[128];
+static uint8_t  glyph8Idx[128];
+static uint16_t glyphCols[SD_NUM_GLYPHS][SD_GLYPH_W];
+static uint16_t glyph8Cols[SD_NUM_GLYPHS8][SD_GLYPH8_W];
+static bool     haveGlyphs = false;
+
+static void buildGlyphCache()
+{
+    const char *ext = ".&*#^$<>~";      // alphaChars 36-44
+    const char *ext8 = ".#$%&'";        // alphaChars8 36-41
+
+    if(haveGlyphs)
+        return;
+
+    memset(glyphIdx, SD_NO_GLYPH, sizeof(glyphIdx));
+    memset(glyph8Idx, SD_NO_GLYPH, sizeof(glyph8Idx));
+    for(int i = 0; i < 10; i++) {
+        glyphIdx['0' + i] = glyph8Idx['0' + i] = i;
+    }
+    for(int i = 0; i < 26; i++) {
+        glyphIdx['A' + i] = glyphIdx['a' + i] = 10 + i;
+        glyph8Idx['A' + i] = glyph8Idx['a' + i] = 10 + i;
+    }
+    for(int i = 0; ext[i]; i++) {
+        glyphIdx[(int)ext[i]] = 36 + i;
+    }
+    for(int i = 0; ext8[i]; i++) {
+        glyph8Idx[(int)ext8[i]] = 36 + i;
+    }
+
+    memset(glyphCols, 0, sizeof(glyphCols));
+    for(int g = 0; g < SD_NUM_GLYPHS; g++) {
+        for(int y = 0; y < SD_GLYPH_H; y++) {
+            for(int x = 0; x < SD_GLYPH_W; x++) {
+                if(alphaChars[g][y] & (0x200 >> x)) 
+                    glyphCols[g][x] |= 1 << (SD_GLYPH_H - 1 - y);
+            }
+        }
+    }
+    memset(glyph8Cols, 0, sizeof(glyph8Cols));
+    for(int g = 0; g < SD_NUM_GLYPHS8; g++) {
+        for(int y = 0; y < SD_GLYPH8_H; y++) {
+            for(int x = 0; x < SD_GLYPH8_W; x++) {
+                if(alphaChars8[g][y] & (0x80 >> x)) 
+                    glyph8Cols[g][x] |= 1 << (SD_GLYPH8_H - 1 - y);
+            }
+        }
+    }
+
+    haveGlyphs = true;
+}
+
+static inline int glyphOf(const uint8_t *idx, char c)
+{
+    return ((uint8_t)c < 128) ? idx[(uint8_t)c] : SD_NO_GLYPH;
+}
+
+// OR a cached glyph (w columns of h rows) into field with its 
+// top left corner at x, y; clipped at the field's edges
+static void glyphToField(sidField *field, const uint16_t *cols, int w, int h, int x, int y)
+{
+    int s = SD_FIELD_ROWS - y - h;     // Shift of glyph's bottom row
+
+    for(int i = 0; i < w; i++, x++) {
+        if((unsigned)x >= SD_FIELD_COLS)
+            continue;
+        uint32_t c = cols[i];
+        if(s >= 0) {
+            c = (s < SD_FIELD_ROWS) ? ((c << s) & SD_FIELD_MASK) : 0;
+        } else {
+            c = (-s < 16) ? (c >> -s) : 0;
+        }
+        field->col[x] |= c;
+    }
+}
+
 // Store i2c address and display ID
 sidDisplay::sidDisplay(uint8_t address1, uint8_t address2)
 {
     _address[0] = address1;
     _address[1] = address2;
+
+    memset(&_want, 0, sizeof(_want));
+    memset(_want.level, 255, sizeof(_want.level));
+    _want.grayBits = SD_GRAY_AUTO;
+    memset(_lastCmd, 0, sizeof(_lastCmd));
+    for(int j = 0; j < 2; j++) {
+        _chip[j].cmd = 0x00;    // RAM start address
+    }
+
+    // Chip state is unknown: First flush sends everything
+    _want.cmdEpoch = _cmdEpoch + 1;
+    _want.ramEpoch = _ramEpoch + 1;
 }
 
 // Start the display
 void sidDisplay::begin()
 {
+    buildGlyphCache();
+
     directCmd(0x20 | 1);    // turn on oscillator
 
     clearBuf();             // clear buffer
@@ -257,10 +496,44 @@ void sidDisplay::begin()
     on();                   // turn it on
 }
 
+// Move I2C traffic into a task on the given core. From then on,
+// show() and the command functions only queue the wanted state and
+// return at once. A job not yet started is replaced by a newer one.
+// Should be the core of the caller, so the time stamps passed to
+// the flush callback are comparable with the caller's.
+// Column levels (grayscale) only work with the flush task.
+bool sidDisplay::beginAsync(int core)
+{
+    const esp_timer_create_args_t timerArgs = {
+        .callback = grayTimerCb,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "sidGray",
+        .skip_unhandled_events = true
+    };
+    const esp_timer_create_args_t dimTimerArgs = {
+        .callback = dimTimerCb,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "sidDim",
+        .skip_unhandled_events = true
+    };
+    
+    if(_flushTask)
+        return true;
+
+    if(esp_timer_create(&timerArgs, &_grayTimer) != ESP_OK ||
+       esp_timer_create(&dimTimerArgs, &_dimTimer) != ESP_OK)
+        return false;
+
+    return (xTaskCreatePinnedToCore(flushTask, "sidFlush", SD_FLUSH_STACK, this,
+                                    SD_FLUSH_PRIO, &_flushTask, core) == pdPASS);
+}
+
 // Turn on the display
 void sidDisplay::on()
 {
-    directCmd(0x80 | 1);
+    directCmd(0x80 | (_blink << 1) | 1);
 }
 
 // Turn off the display
@@ -269,25 +542,43 @@ void sidDisplay::off()
     directCmd(0x80);
 }
 
+// Blink the whole display in hardware (SD_BLINK_xxx); costs no
+// bus traffic while blinking. Applies now if the display is on, 
+// otherwise with the next on().
+void sidDisplay::setBlink(uint8_t blink)
+{
+    _blink = blink & 3;
+
+    if(_want.cmd[SD_CMD_DISP] & 1) {
+        on();
+    }
+}
+
+uint8_t sidDisplay::getBlink()
+{
+    return _blink;
+}
+
+// True if the display was last turned on (not off)
+bool sidDisplay::isOn()
+{
+    return (_want.cmd[SD_CMD_DISP] & 1);
+}
+
 void sidDisplay::lampTest()
 { 
     for(int j = 0; j < 2; j++) {
-        Wire.beginTransmission(_address[j]);  
-        Wire.write(0x00);  // start address
-        for(int i = 0; i < SD_BUF_SIZE / 2; i++) {
-            Wire.write(0xff);
-            Wire.write(0xff);
-        }
-        Wire.endTransmission();
+        memset(_want.chip[j].ram, 0xff, sizeof(_want.chip[j].ram));
     }
+    submit();
 }
 
 
 // Clear the buffer
 void sidDisplay::clearBuf()
 {
-    for(int i = 0; i < SD_BUF_SIZE; i++) {
-        _displayBuffer[i] = 0;
+    for(int j = 0; j < 2; j++) {
+        memset(_chip[j].ram, 0, sizeof(_chip[j].ram));
     }
 }
 
@@ -335,16 +626,11 @@ void sidDisplay::drawBarWithHeight(uint8_t bar, uint8_t height)
     if(height > 127) height = 0;
     if(height > 20) height = 20;
 
-    if(height < 20) {
-        for(int i = 0; i < 20 - height; i++) {
-            _displayBuffer[translator[bar][i][0]] &= ~(translator[bar][i][1]);
-        }
-    }
-    if(height > 0) {
-        for(int i = 20 - height; i < 20; i++) {
-            _displayBuffer[translator[bar][i][0]] |= translator[bar][i][1];
-        }
-    }
+    const sdBarMask *m = &barMasks[bar][height];
+    const sdBarMask *f = &barMasks[bar][20];
+
+    dbuf(barLoWord(bar)) = m->lo;
+    dbuf(barHiWord(bar)) = (dbuf(barHiWord(bar)) & ~f->hi) | m->hi;
 }
 
 // Draw bar into buffer, do NOT call show
@@ -357,26 +643,18 @@ void sidDisplay::drawBar(uint8_t bar, uint8_t bottom, uint8_t top)
     if(bottom > 19) bottom = 19;
     if(bottom > top) bottom = top;
 
-    if(top < 19) {
-        for(int i = 0; i <= 19-top; i++) {
-            _displayBuffer[translator[bar][i][0]] &= ~(translator[bar][i][1]);
-        }
-    }
-    if(bottom > 0) {
-        for(int i = 19; i <= 19-bottom; i--) {
-            _displayBuffer[translator[bar][i][0]] &= ~(translator[bar][i][1]);
-        }
-    }
-    for(int i = 19-top; i <= 19-bottom; i++) {
-        _displayBuffer[translator[bar][i][0]] |= translator[bar][i][1];
-    }
+    const sdBarMask *t = &barMasks[bar][top + 1];
+    const sdBarMask *b = &barMasks[bar][bottom];
+    const sdBarMask *f = &barMasks[bar][20];
+
+    dbuf(barLoWord(bar)) = t->lo & ~b->lo;
+    dbuf(barHiWord(bar)) = (dbuf(barHiWord(bar)) & ~f->hi) | (t->hi & ~b->hi);
 }
 
 void sidDisplay::clearBar(uint8_t bar)
 {
-    for(int i = 0; i <= 19; i++) {
-        _displayBuffer[translator[bar][i][0]] &= ~(translator[bar][i][1]);
-    }
+    dbuf(barLoWord(bar)) = 0;
+    dbuf(barHiWord(bar)) &= ~barMasks[bar][20].hi;
 }
 
 // Draw dot into buffer, do NOT call show
@@ -386,151 +664,135 @@ void sidDisplay::drawDot(uint8_t bar, uint8_t dot_y)
     // Draw dot at dot_y (0 = bottom)
     if(dot_y > 19) dot_y = 19;
 
-    _displayBuffer[translator[bar][19-dot_y][0]] |= translator[bar][19-dot_y][1];
+    dbuf(barLoWord(bar)) |= barMasks[bar][dot_y + 1].lo & ~barMasks[bar][dot_y].lo;
+    dbuf(barHiWord(bar)) |= barMasks[bar][dot_y + 1].hi & ~barMasks[bar][dot_y].hi;
+}
+
+// Convert field to display buffer; overwrites the entire buffer
+void sidDisplay::drawField(const sidField *field)
+{
+    for(int i = 10; i < SD_BUF_SIZE; i++) {
+        dbuf(i) = 0;
+    }
+    for(int i = 0; i < SD_FIELD_COLS; i++) {
+        uint32_t c = field->col[i];
+        dbuf(barLoWord(i)) = (uint16_t)c;
+        dbuf(barHiWord(i)) |= ((c >> 16) & 0x0f) << barHiShift(i);
+    }
+}
+
+// Convert display buffer to field
+void sidDisplay::getField(sidField *field)
+{
+    for(int i = 0; i < SD_FIELD_COLS; i++) {
+        field->col[i] = dbuf(barLoWord(i)) | 
+                        ((uint32_t)((dbuf(barHiWord(i)) >> barHiShift(i)) & 0x0f) << 16);
+    }
 }
 
 void sidDisplay::drawFieldAndShow(uint8_t *fieldData)
 {
+    sidField field;
+    
     // Draw entire field. Data is 0 or 1, organized in lines
+    field.clear();
     for(int i = 0, k = 0; i < 20; i++, k += 10) {
         for(int j = 0; j < 10; j++) {
             if(fieldData[k+j]) {
-                _displayBuffer[translator[j][i][0]] |= translator[j][i][1];
-            } else {
-                _displayBuffer[translator[j][i][0]] &= ~(translator[j][i][1]);
+                field.setPixel(j, i);
             }
         }
     }
+    drawField(&field);
     show();
 }
 
 void sidDisplay::drawLetterAndShow(char alpha, int x, int y)
 {
-    uint8_t field[20*10] = { 0 };
-    int w = 10, h = 10, fx = 0, fy = 0, a = 0x200, s;
+    sidField field;
+    int g = glyphOf(glyphIdx, alpha);
 
-    if(x < -9 || x > 9 || y < -9 || y > 19) {
+    if(x < -9 || x > 9 || y < -9 || y > 19 || g == SD_NO_GLYPH) {
         clearDisplayDirect();
         return;
     }
-    
-    if(alpha >= '0' && alpha <= '9') {
-        alpha -= '0';
-    } else if(alpha >= 'A' && alpha <= 'Z') {
-        alpha -= ('A' - 10);
-    } else if(alpha >= 'a' && alpha <= 'z') {
-        alpha -= ('a' - 10);
-    } else if(alpha == '.') {
-        alpha = 36;
-    } else if(alpha == '&') {
-        alpha = 37;
-    } else if(alpha == '*') {
-        alpha = 38;
-    } else if(alpha == '#') {
-        alpha = 39;
-    } else if(alpha == '^') {
-        alpha = 40;
-    } else if(alpha == '$') {
-        alpha = 41;
-    } else if(alpha == '<') {
-        alpha = 42;
-    } else if(alpha == '>') {
-        alpha = 43;
-    } else if(alpha == '~') {
-        alpha = 44;
-    } else {
-        clearDisplayDirect();   
-        return;
-    }
 
-    if(x < 0) {
-        fx = -x;
-        a >>= fx;
-        w = 10 - fx;
-        x = 0;
-    } else if(x > 0) {
-        w = 10 - x;
-    }
-    if(y < 0) {
-        fy = -y;
-        h = 10 - fy;
-        y = 0;
-    } else if(y > (20-10)) {       
-        h = 20 - y;           
-    }
-
-    for(int yy = fy; yy < h; yy++, y++) {
-        uint16_t font = alphaChars[alpha][yy];
-        int xxx = x;
-        for(int xx = fx, s = a; xx < w; xx++, s >>= 1, xxx++) {
-            if(font & s) {
-                field[(y*10) + xxx] = 1;
-            }
-        }
-    }
-    drawFieldAndShow(field);
+    field.clear();
+    glyphToField(&field, glyphCols[g], SD_GLYPH_W, SD_GLYPH_H, x, y);
+    drawField(&field);
+    show();
 }
 
 void sidDisplay::drawLetterMask(char alpha, int x, int y)
 {
-    int w = 8, h = 8, fx = 0, fy = 0, a = 0x80, s;
+    sidField field, mask;
+    int g = glyphOf(glyph8Idx, alpha);
 
-    if(x < -7 || x > 9 || y < -7 || y > 19) {
+    if(x < -7 || x > 9 || y < -7 || y > 19 || g == SD_NO_GLYPH) {
         return;
     }
-    
-    if(alpha >= '0' && alpha <= '9') {
-        alpha -= '0';
-    } else if(alpha >= 'A' && alpha <= 'Z') {
-        alpha -= ('A' - 10);
-    } else if(alpha >= 'a' && alpha <= 'z') {
-        alpha -= ('a' - 10);
-    } else if(alpha == '.') {
-        alpha = 36;
-    } else if(alpha == '#') {
-        alpha = 37;
-    } else if(alpha >= '$' && alpha <= '\'') {
-        alpha -= '$';
-        alpha += 38;
-    } else { 
+
+    mask.clear();
+    glyphToField(&mask, glyph8Cols[g], SD_GLYPH8_W, SD_GLYPH8_H, x, y);
+
+    getField(&field);
+    field.andNotField(mask);
+    drawField(&field);
+}
+
+/*
+ * Marquee
+ *
+ * Text scrolls upwards through the display, one row per step: The
+ * field moves up by one bit, and the next row of the current glyph 
+ * comes in at the bottom, taken from the glyph cache. After the
+ * text, it scrolls out completely before starting over.
+ */
+
+void sidDisplay::marqueeStart(const char *text)
+{
+    _mqText = text;
+    _mqPos = 0;
+    _mqRow = 0;
+    _mqField.clear();
+}
+
+// Scroll by one row and draw the result into the buffer; 
+// caller does show()
+void sidDisplay::marqueeStep()
+{
+    if(!_mqText)
         return;
-    }
 
-    if(x < 0) {
-        fx = -x;
-        a >>= fx;
-        w = 8 - fx;
-        x = 0;
-    } else if(x > 2) {
-        w = 8 - x;
-    }
-    if(y < 0) {
-        fy = -y;
-        h = 8 - fy;
-        y = 0;
-    } else if(y > (20-8)) {       
-        h = 20 - y;           
-    }
-
-    for(int yy = fy; yy < h; yy++, y++) {
-        uint8_t font = alphaChars8[alpha][yy];
-        int xxx = x;
-        for(int xx = fx, s = a; xx < w; xx++, s >>= 1, xxx++) {
-            if(font & s) {
-                _displayBuffer[translator[xxx][y][0]] &= ~(translator[xxx][y][1]);
+    _mqField.shiftUp(1);
+
+    if(_mqText[_mqPos]) {
+        int g = glyphOf(glyphIdx, _mqText[_mqPos]);
+        if(g != SD_NO_GLYPH && _mqRow < SD_GLYPH_H) {
+            int s = SD_GLYPH_H - 1 - _mqRow;
+            for(int i = 0; i < SD_GLYPH_W; i++) {
+                _mqField.col[i] |= (glyphCols[g][i] >> s) & 1;
             }
         }
+        if(++_mqRow == SD_GLYPH_H + SD_MARQUEE_GAP) {
+            _mqRow = 0;
+            _mqPos++;
+        }
+    } else if(++_mqRow == SD_FIELD_ROWS) {
+        _mqRow = 0;
+        _mqPos = 0;
     }
+
+    drawField(&_mqField);
 }
 
 void sidDisplay::drawClockAndShow(uint8_t *dateBuf, int dx, int dy)
 {
-    uint8_t field[20*10] = { 0 };
-    uint8_t fields[11*9] = { 0 };
+    sidField field;
     int x[4], y[4], nums[4];
     int ampm = -1;
     uint8_t t = dateBuf[4];
-    int s, c, cx, h, w, ox, oy, yyy;
+    int c;
 
     if(dx < -9 || dy < -11 || dx > 9 || dy > 19) {
         clearDisplayDirect();   
@@ -549,79 +811,861 @@ void sidDisplay::drawClockAndShow(uint8_t *dateBuf, int dx, int dy)
     nums[2] = dateBuf[5] / 10;
     nums[3] = dateBuf[5] % 10;
     
+    // Digits form a 9x11 block at dx/dy; setPixel() clips
+    field.clear();
     for(c = 0; c < 4; c++) {
-        for(int yy = y[c], yyy = 0; yy < y[c] + 5; yy++, yyy++) {
+        for(int yy = dy + y[c], yyy = 0; yyy < 5; yy++, yyy++) {
             uint8_t font = numChars4[nums[c]][yyy];
-            for(int xx = x[c], s = 0x08; xx < x[c] + 4; xx++, s >>= 1) {
+            for(int xx = dx + x[c], s = 0x08; s; xx++, s >>= 1) {
                 if(font & s) {
-                    fields[(yy*9) + xx] = 1;
+                    field.setPixel(xx, yy);
                 }
             }
         }
     }
     
-    if(dx < 0) {
-        ox = -dx;
-        w = 9 - ox;
-        dx = 0;
-    } else {
-        ox = 0;
-        w = min((10 - dx), 9);
+    drawField(&field);
+    show();
+}
+
+
+// Show the buffer
+void sidDisplay::show()
+{
+    memcpy(_want.chip, _chip, sizeof(_chip));
+    submit();
+}
+
+// Show the buffer; the flush callback gets the tag once it is out
+void sidDisplay::show(uint32_t tag)
+{
+    memcpy(_want.chip, _chip, sizeof(_chip));
+    _want.tag = tag;
+    _want.tagged = true;
+    submit();
+    _want.tagged = false;
+}
+
+// Hand the wanted state to the flush task, or flush it right
+// here if there is no flush task
+void sidDisplay::submit()
+{
+    _want.ready = ESP.getCycleCount();
+
+    // Count LEDs for the current limiter
+    _want.lit = 0;
+    for(int i = 0; i < SD_BUF_SIZE; i++) {
+        _want.lit += __builtin_popcount(_want.chip[i >> 3].ram[i & 7] & ledMask[i]);
+    }
+
+    if(!_flushTask) {
+        flush(&_want);
+        return;
+    }
+
+    *_jobs.writeBuf() = _want;
+    _jobs.publish();
+    _submitSeq++;
+    xTaskNotify(_flushTask, SD_NOTIFY_JOB, eSetBits);
+}
+
+void sidDisplay::flushTask(void *pvParameters)
+{
+    ((sidDisplay *)pvParameters)->flushLoop();
+}
+
+void sidDisplay::grayTimerCb(void *arg)
+{
+    xTaskNotify(((sidDisplay *)arg)->_flushTask, SD_NOTIFY_PLANE, eSetBits);
+}
+
+void sidDisplay::dimTimerCb(void *arg)
+{
+    xTaskNotify(((sidDisplay *)arg)->_flushTask, SD_NOTIFY_DIM, eSetBits);
+}
+
+/*
+ * Grayscale
+ *
+ * Column levels are quantized to _grayBits bits. Plane p shows the
+ * columns whose level has bit p set, for _grayUnit << p us; a full
+ * period lasts _grayUnit * (2^bits - 1) us. The plane timer notifies
+ * the flush task, which writes the next plane through the usual 
+ * partial update. The unit follows the measured plane write time,
+ * so a plane is always on the chips before its time is up.
+ * While no column has an intermediate level, all planes are the 
+ * same, and nothing runs.
+ */
+static inline uint16_t& imgWord(sdChipImage *chip, int idx)
+{
+    return chip[idx >> 3].ram[idx & 7];
+}
+
+void sidDisplay::flushLoop()
+{
+    const sdFlushJob *job = NULL, *next;
+    TickType_t wait;
+    uint32_t ev;
+
+    for(;;) {
+        wait = portMAX_DELAY;
+        if(job && _txFailed && !_grayRunning) {
+            long ms = (long)(_retryAt - millis());
+            wait = (ms > 0) ? pdMS_TO_TICKS(ms) : 0;
+        } else if(job && _scrubBudget && !_grayRunning) {
+            long ms = (long)(_scrubNext - millis());
+            wait = (ms > 0) ? pdMS_TO_TICKS(ms) : 0;
+        }
+        if(!xTaskNotifyWait(0, 0xffffffff, &ev, wait)) {
+            ev = 0;
+        }
+
+        if((next = _jobs.acquire())) {
+            job = next;
+        }
+        if(!job)
+            continue;
+
+        if((ev & SD_NOTIFY_PLANE) && _grayRunning) {
+            if(++_grayPlane >= _grayBits) {
+                _grayPlane = 0;
+                setGrayTiming(job);
+            }
+            if(!needPlanes(job, _grayBits)) {
+                _grayRunning = false;
+                flushPlane(job, 0, next != NULL);
+                continue;
+            }
+            esp_timer_start_once(_grayTimer, (uint64_t)_grayUnit << _grayPlane);
+            flushPlane(job, _grayPlane, next != NULL);
+        } else if((ev & SD_NOTIFY_DIM) && !next) {
+            dimStep(job, true);
+        } else if(next) {
+            if(!_grayRunning) {
+                _grayPlane = 0;
+                setGrayTiming(job);
+            }
+            if(needPlanes(job, _grayBits)) {
+                if(!_grayRunning) {
+                    _grayRunning = true;
+                    esp_timer_start_once(_grayTimer, _grayUnit);
+                }
+            } else if(_grayRunning) {
+                esp_timer_stop(_grayTimer);
+                _grayRunning = false;
+                _grayPlane = 0;
+            }
+            flushPlane(job, _grayPlane, true);
+        }
+
+        if(_grayRunning || _jobs.pending())
+            continue;
+
+        // Repeat a failed flush SD_RETRY_MS after the failure, unless
+        // a newer job did it already. (Planes are repeated anyway.)
+        // Scrub only while nothing else is waiting to go out.
+        if(_txFailed) {
+            if((long)(millis() - _retryAt) >= 0) {
+                sdFlushJob rj = *job;
+                rj.tagged = false;
+                _retries++;
+                flush(&rj);
+            }
+        } else if(_scrubBudget && (long)(millis() - _scrubNext) >= 0) {
+            scrubStep();
+        }
+    }
+}
+
+// Choose unit and number of planes for the next period
+void sidDisplay::setGrayTiming(const sdFlushJob *job)
+{
+    _grayUnit = max((uint32_t)SD_GRAY_MIN_UNIT, _planeUsMax * 5 / 4);
+
+    if(job->grayBits != SD_GRAY_AUTO) {
+        _grayBits = min((int)job->grayBits, SD_GRAY_MAX_BITS);
+        return;
+    }
+    
+    for(_grayBits = SD_GRAY_MAX_BITS; _grayBits > 1; _grayBits--) {
+        if(_grayUnit * ((1 << _grayBits) - 1) <= 1000000 / SD_GRAY_MIN_HZ)
+            break;
+    }
+}
+
+// True if some column has a level between off and full
+bool sidDisplay::needPlanes(const sdFlushJob *job, int bits)
+{
+    int full = (1 << bits) - 1;
+    
+    for(int i = 0; i < SD_FIELD_COLS; i++) {
+        int q = job->level[i] >> (8 - bits);
+        if(q && q != full)
+            return true;
     }
-    if(dy < 0) {
-        oy = -dy;
-        h = 11 - oy;
-        dy = 0;
+    return false;
+}
+
+// Flush job with the columns not lit in given plane blanked
+void sidDisplay::flushPlane(const sdFlushJob *job, int plane, bool first)
+{
+    sdFlushJob pj = *job;
+    uint32_t us, start;
+
+    for(int i = 0; i < SD_FIELD_COLS; i++) {
+        if(!(((job->level[i] >> (8 - _grayBits)) >> plane) & 1)) {
+            imgWord(pj.chip, barLoWord(i)) = 0;
+            imgWord(pj.chip, barHiWord(i)) &= ~barMasks[i][20].hi;
+        }
+    }
+    if(!first) {
+        pj.tagged = false;
+    }
+
+    start = ESP.getCycleCount();
+    flush(&pj);
+    us = (ESP.getCycleCount() - start) / ESP.getCpuFreqMHz();
+
+    if(us > _planeUsMax) {
+        _planeUsMax = us;
     } else {
-        oy = 0;
-        h = min((20-dy), 11);
+        _planeUsMax -= (_planeUsMax - us) / 64;
     }
+}
 
-    for(int yy = dy, c = oy; c < h; yy++, c++) {
-        for(int xx = dx, cx = ox; cx < w; xx++, cx++) {
-            field[(yy*10)+xx] = fields[(c*9)+cx];
+/*
+ * RAM scrubber
+ *
+ * A disturbed I2C transfer can leave wrong LEDs lit until the
+ * next content change. So the flush task reads back the display 
+ * RAM, SD_SCRUB_WORDS at a time, and rewrites words that differ
+ * from what was sent. Steps are spaced so that they take no more
+ * than _scrubBudget us of bus time per second. The scrubber stands
+ * back while grayscale runs, as planes change the RAM all the time.
+ */
+void sidDisplay::scrubStep()
+{
+    int j = _scrubPos >> 3, first = _scrubPos & 7;
+    size_t len = SD_SCRUB_WORDS * 2;
+    uint16_t got[SD_SCRUB_WORDS];
+    uint32_t start = ESP.getCycleCount(), us;
+
+    Wire.beginTransmission(_address[j]);
+    Wire.write(first * 2);              // start address
+    if(!txOK(j, Wire.endTransmission(false)) ||
+       !txOK(j, (Wire.requestFrom(_address[j], len) == len) ? 0 : 4) ||
+       Wire.readBytes((uint8_t *)got, len) != len) {
+        _scrubErrors++;
+    } else {
+        for(int i = 0; i < SD_SCRUB_WORDS; i++) {
+            if(got[i] == _sent[j][first + i])
+                continue;
+            Wire.beginTransmission(_address[j]);
+            Wire.write((first + i) * 2);
+            Wire.write((const uint8_t *)&_sent[j][first + i], 2);
+            txOK(j, Wire.endTransmission());
+            _busBytes += 4;
+            _scrubRepairs++;
         }
     }
+    if(_failStreak >= SD_RECOVER_AFTER) {
+        busRecover();
+    }
+    _busBytes += 3 + len;
+    _scrubWords += SD_SCRUB_WORDS;
+    _scrubPos = (_scrubPos + SD_SCRUB_WORDS) % SD_BUF_SIZE;
+
+    us = (ESP.getCycleCount() - start) / ESP.getCpuFreqMHz();
+    _scrubNext = millis() + max((uint32_t)SD_SCRUB_MIN_MS, us * 1000 / _scrubBudget);
+}
+
+// Bus time (us per second) the RAM scrubber may use; 0 = off.
+// Only works with the flush task.
+void sidDisplay::setScrubBudget(uint32_t usPerSec)
+{
+    _scrubBudget = usPerSec;
+}
+
+// Display RAM words read back and checked
+uint32_t sidDisplay::getScrubWords()
+{
+    return _scrubWords;
+}
+
+// Words found corrupted and rewritten
+uint32_t sidDisplay::getScrubRepairs()
+{
+    return _scrubRepairs;
+}
+
+// Failed read backs
+uint32_t sidDisplay::getScrubErrors()
+{
+    return _scrubErrors;
+}
+
+/*
+ * I2C errors
+ *
+ * Every transaction's result is checked. A failed RAM write leaves
+ * the words it carried marked as unknown in _sent, a failed command
+ * clears it from _lastCmd, so the next flush sends them again. With 
+ * the flush task, the latest job is flushed once more after 
+ * SD_RETRY_MS unless a newer one arrives first; nothing is queued.
+ * After SD_RECOVER_AFTER failures in a row, the bus is assumed 
+ * stuck (a chip holding SDA low after an interrupted transfer): 
+ * SCL is clocked until SDA is released, followed by a STOP, and 
+ * Wire is started again.
+ */
+bool sidDisplay::txOK(int chip, uint8_t err)
+{
+    if(!err) {
+        _failStreak = 0;
+        return true;
+    }
     
-    drawFieldAndShow(field);
+    _txErrors[chip]++;
+    if(_failStreak < 255) _failStreak++;
+    _txFailed = true;
+    _retryAt = millis() + SD_RETRY_MS;
+    return false;
 }
 
+void sidDisplay::busRecover()
+{
+    uint32_t freq = Wire.getClock();
 
-// Show the buffer
-void sidDisplay::show()
+    Wire.end();
+
+    pinMode(SDA, INPUT_PULLUP);
+    pinMode(SCL, OUTPUT_OPEN_DRAIN);
+    digitalWrite(SCL, HIGH);
+    delayMicroseconds(5);
+    for(int i = 0; i < 9 && !digitalRead(SDA); i++) {
+        digitalWrite(SCL, LOW);
+        delayMicroseconds(5);
+        digitalWrite(SCL, HIGH);
+        delayMicroseconds(5);
+    }
+    pinMode(SDA, OUTPUT_OPEN_DRAIN);
+    digitalWrite(SDA, LOW);
+    delayMicroseconds(5);
+    digitalWrite(SDA, HIGH);            // STOP
+    delayMicroseconds(5);
+
+    Wire.begin(SDA, SCL, freq);
+
+    // The chips may have missed anything: Next flush sends all
+    // commands, and all RAM (as after invalidateRAMCache())
+    memset(_lastCmd, 0, sizeof(_lastCmd));
+    _ramEpoch++;
+    _failStreak = 0;
+    _txFailed = true;
+    _retryAt = millis();
+    _busRecoveries++;
+}
+
+// Failed transactions per chip
+uint32_t sidDisplay::getTxErrors(int chip)
+{
+    return _txErrors[chip];
+}
+
+// Flushes repeated after an error
+uint32_t sidDisplay::getRetries()
 {
-    uint16_t *tp = &_displayBuffer[0];
+    return _retries;
+}
+
+uint32_t sidDisplay::getBusRecoveries()
+{
+    return _busRecoveries;
+}
+
+/*
+ * Master dimmer
+ *
+ * The HT16K33 has 16 dim levels with a duty cycle of (level+1)/16,
+ * and off. The gamma-corrected duty is rounded down to one of these
+ * levels, and the remainder is made up for by showing the next level
+ * on some ticks, chosen by a sigma-delta accumulator: This spreads
+ * them out evenly, so even dithering between off and level 0 (the 
+ * lowest master levels) does not flicker in blocks. A job arriving
+ * between ticks reuses the last tick's choice.
+ * Fades are linear in the 0-255 level (which is perceptually even 
+ * after gamma). The dim command (setBrightness()) scales the result, 
+ * so effects built on it keep working.
+ * While fading or dithering, a SD_DIM_TICK timer drives dimStep() 
+ * with tick set; otherwise the dimmer runs only when a job arrives.
+ * Without the flush task there is no timer: Fades are skipped and
+ * the duty is rounded to the nearest level.
+ * Commands go out only when the level changes; dithering costs up 
+ * to one command per chip and tick (1000 per chip per second, about
+ * 10% of the bus at 400kHz), and fewer the closer the duty is to a 
+ * dim level.
+ */
+void sidDisplay::dimStep(const sdFlushJob *job, bool tick)
+{
+    unsigned long now = millis();
+    uint32_t duty, v, f, step, sub;
+    bool fading = false, ticking;
+    bool timed = (_flushTask && _dimTimer);
     
-    for(int j = 0; j < 2; j++) {
-        Wire.beginTransmission(_address[j]);
-        Wire.write(0x00);
-        for(int i = 0; i < SD_BUF_SIZE / 2; i++) {
-            uint16_t t = *tp++;
-            Wire.write(t & 0xff);
-            Wire.write(t >> 8);
+    if(job->fadeGen != _fadeGen) {
+        _fadeGen = job->fadeGen;
+        _fadeFrom = _dimCur;
+        _fadeTo = (uint32_t)job->master << 8;
+        _fadeStart = now;
+        _fadeMs = timed ? job->fadeMs : 0;
+    }
+
+    if(now - _fadeStart < _fadeMs) {
+        int32_t d = (int32_t)(_fadeTo - _fadeFrom);
+        _dimCur = _fadeFrom + (int32_t)((int64_t)d * (int32_t)(now - _fadeStart) / _fadeMs);
+        fading = true;
+    } else {
+        _dimCur = _fadeTo;
+    }
+
+    v = _dimCur >> 8;
+    f = _dimCur & 0xff;
+    duty = gammaTable[v];
+    if(v < 255) {
+        duty += ((gammaTable[v + 1] - duty) * f) >> 8;
+    }
+    if(job->cmd[SD_CMD_DIM]) {
+        duty = duty * ((job->cmd[SD_CMD_DIM] & 0x0f) + 1) / 16;
+    }
+    _capped = (duty > _dutyCap);
+    if(_capped) {
+        duty = _dutyCap;
+    }
+    _dutyNow = duty;
+
+    // 0 = off, n = dim level n - 1
+    step = duty >> 8;
+    sub = duty & 0xff;
+    if(!timed) {
+        // Nothing would move the dither on: nearest level instead
+        step = (duty + 128) >> 8;
+        if(!step && duty) {
+            step = 1;
+        }
+        sub = 0;
+    }
+    if(tick) {
+        _ditherAcc += sub;
+        _ditherUp = (_ditherAcc >= 256);
+        _ditherAcc &= 0xff;
+    }
+    if(sub && _ditherUp) {
+        step++;
+    }
+    
+    if(!step || job->cmd[SD_CMD_DISP] == 0x80) {
+        sendCmd(SD_CMD_DISP, 0x80);
+    } else {
+        sendCmd(SD_CMD_DIM, 0xe0 | (step - 1));
+        sendCmd(SD_CMD_DISP, job->cmd[SD_CMD_DISP] ? job->cmd[SD_CMD_DISP] : 0x81);
+    }
+
+    ticking = fading || sub;
+    if(timed && ticking != _dimTicking) {
+        if(ticking) {
+            esp_timer_start_periodic(_dimTimer, SD_DIM_TICK);
+        } else {
+            esp_timer_stop(_dimTimer);
         }
-        Wire.endTransmission();
+        _dimTicking = ticking;
     }
 }
 
-void sidDisplay::clearDisplayDirect()
+/*
+ * Current limiter
+ *
+ * The LEDs' current is estimated from the number of LEDs on (counted
+ * by submit()) times their duty cycle. Where this exceeds the budget,
+ * the duty is capped: The master dimmer cannot go above the cap, 
+ * without it the dim level is lowered. Level 0 is the lowest the
+ * latter can go.
+ */
+void sidDisplay::setDim(const sdFlushJob *job)
+{
+    uint8_t dim = job->cmd[SD_CMD_DIM];
+
+    if(job->dimmer) {
+        dimStep(job, false);
+        return;
+    }
+
+    _capped = false;
+    if(dim) {
+        int maxLevel = (int)(_dutyCap * 16 / SD_DUTY_FULL) - 1;
+        if(maxLevel < 0) maxLevel = 0;
+        if((dim & 0x0f) > maxLevel) {
+            dim = 0xe0 | maxLevel;
+            _capped = true;
+        }
+        _dutyNow = ((dim & 0x0f) + 1) * SD_DUTY_FULL / 16;
+    }
+    sendCmd(SD_CMD_DIM, dim);
+    sendCmd(SD_CMD_DISP, job->cmd[SD_CMD_DISP]);
+}
+
+// Limit the LEDs' current to budgetMa, given the current of one LED
+// at full brightness (mA). 0 = no limit.
+void sidDisplay::setCurrentBudget(uint16_t budgetMa, uint16_t ledMa)
+{
+    _budgetMa = ledMa ? budgetMa : 0;
+    _ledMa = ledMa;
+}
+
+uint32_t sidDisplay::getLitLEDs()
+{
+    return _lit;
+}
+
+// Estimated current of the LEDs (mA)
+uint32_t sidDisplay::getCurrentMa()
+{
+    return (_dutyNow * _lit * _ledMa) / SD_DUTY_FULL;
+}
+
+// Flushes where brightness was lowered to stay within budget
+uint32_t sidDisplay::getLimitedFlushes()
+{
+    return _limitedFlushes;
+}
+
+// Set master dimmer level (0-255, gamma corrected), reached in fadeMs
+// (fades need the flush task, see beginAsync(); otherwise at once).
+// From then on, the master dimmer controls on/off; off() and 
+// setBrightness() still apply on top.
+void sidDisplay::setMaster(uint8_t level, uint16_t fadeMs)
+{
+    if(_want.dimmer && _want.master == level)
+        return;
+
+    _want.dimmer = true;
+    _want.master = level;
+    _want.fadeMs = fadeMs;
+    _want.fadeGen++;
+    submit();
+}
+
+// Master dimmer target; full while the master dimmer is unused
+uint8_t sidDisplay::getMaster()
+{
+    return _want.dimmer ? _want.master : 255;
+}
+
+// Intensity of a column (0-255) in grayscale; takes effect with 
+// the next show()
+void sidDisplay::setColumnLevel(uint8_t col, uint8_t level)
+{
+    if(col < SD_FIELD_COLS) {
+        _want.level[col] = level;
+    }
+}
+
+uint8_t sidDisplay::getColumnLevel(uint8_t col)
+{
+    return (col < SD_FIELD_COLS) ? _want.level[col] : 0;
+}
+
+void sidDisplay::resetColumnLevels()
+{
+    memset(_want.level, 255, sizeof(_want.level));
+}
+
+// Number of bit planes (1-SD_GRAY_MAX_BITS), or SD_GRAY_AUTO
+void sidDisplay::setGrayBits(uint8_t bits)
+{
+    _want.grayBits = bits;
+}
+
+uint8_t sidDisplay::getGrayBits()
+{
+    return _grayRunning ? _grayBits : 0;
+}
+
+uint32_t sidDisplay::getGrayUnitUs()
+{
+    return _grayUnit;
+}
+
+uint32_t sidDisplay::getGrayRefreshHz()
 {
+    return _grayRunning ? 1000000 / (_grayUnit * ((1 << _grayBits) - 1)) : 0;
+}
+
+// Bring the chips to the state in job
+// Of the display RAM, only the words that differ from what the chip 
+// already holds are sent, as one run from the first to the last 
+// changed word. Chips without changes are skipped.
+// A bar spans both chips, and each chip shows its new RAM at the
+// end of its own transaction. To keep the time between the two 
+// (tearing) short, both runs are worked out beforehand and sent back
+// to back, the longer one first; the skew then is the duration of
+// the shorter transaction.
+void sidDisplay::flush(const sdFlushJob *job)
+{
+    uint32_t start;
+    int first[2], last[2], len[2], order[2];
+    uint8_t err[2] = { 0, 0 };
+
+    // Set again by any failure below
+    _txFailed = false;
+
+    if(job->cmdEpoch != _cmdEpoch) {
+        memset(_lastCmd, 0, sizeof(_lastCmd));
+        _cmdEpoch = job->cmdEpoch;
+    }
+    if(job->ramEpoch != _ramEpoch) {
+        for(int j = 0; j < 2; j++) {
+            for(int i = 0; i < SD_BUF_SIZE / 2; i++) {
+                _sent[j][i] = ~job->chip[j].ram[i];
+            }
+        }
+        _ramEpoch = job->ramEpoch;
+    }
+
+    sendCmd(SD_CMD_OSC, job->cmd[SD_CMD_OSC]);
+
+    // Current limiter: Lower brightness before more LEDs light up
+    {
+        uint32_t cap = SD_DUTY_FULL;
+        if(_budgetMa && job->lit) {
+            cap = min((uint32_t)SD_DUTY_FULL, 
+                      (uint32_t)_budgetMa * SD_DUTY_FULL / ((uint32_t)job->lit * _ledMa));
+        }
+        _lit = job->lit;
+        if(cap < _dutyCap) {
+            _dutyCap = cap;
+            setDim(job);
+        } else {
+            _dutyCap = cap;
+        }
+    }
+
     for(int j = 0; j < 2; j++) {
-        Wire.beginTransmission(_address[j]);
-        Wire.write(0x00);
-        for(int i = 0; i < SD_BUF_SIZE / 2; i++) {
-            Wire.write(0x00);
-            Wire.write(0x00);
+        const uint16_t *ram = job->chip[j].ram;
+        const uint16_t *sent = _sent[j];
+
+        first[j] = 0;
+        last[j] = SD_BUF_SIZE / 2 - 1;
+        while(first[j] <= last[j] && ram[first[j]] == sent[first[j]]) first[j]++;
+        if(first[j] > last[j]) {
+            len[j] = 0;
+            continue;
         }
-        Wire.endTransmission();
+        while(ram[last[j]] == sent[last[j]]) last[j]--;
+        len[j] = (last[j] - first[j] + 1) * 2;
     }
+
+    order[0] = (len[1] > len[0]) ? 1 : 0;
+    order[1] = !order[0];
+
+    start = ESP.getCycleCount();
+
+    for(int k = 0; k < 2; k++) {
+        int j = order[k];
+        if(len[j]) {
+            Wire.beginTransmission(_address[j]);
+            if(!first[j]) {
+                Wire.write(&job->chip[j].cmd, 1 + len[j]);
+            } else {
+                Wire.write(first[j] * 2);      // start address
+                Wire.write((const uint8_t *)&job->chip[j].ram[first[j]], len[j]);
+            }
+            err[j] = Wire.endTransmission();
+        }
+        _chipDone[j] = ESP.getCycleCount();
+    }
+
+    for(int j = 0; j < 2; j++) {
+        const uint16_t *ram = job->chip[j].ram;
+        uint16_t *sent = _sent[j];
+
+        if(!len[j]) {
+            _busBytesSaved += 2 + sizeof(job->chip[j].ram);
+            continue;
+        }
+
+        if(txOK(j, err[j])) {
+            memcpy(&sent[first[j]], &ram[first[j]], len[j]);
+        } else {
+            for(int i = first[j]; i <= last[j]; i++) {
+                sent[i] = ~ram[i];
+            }
+        }
+        _busBytes += 2 + len[j];
+        _busBytesSaved += sizeof(job->chip[j].ram) - len[j];
+    }
+
+    if(len[0] || len[1]) {
+        _shows++;
+        _showCycles += _chipDone[order[1]] - start;
+    }
+
+    if(len[0] && len[1]) {
+        uint32_t skew = _chipDone[order[1]] - _chipDone[order[0]];
+        _skewCount++;
+        _skewCycles += skew;
+        if(skew > _skewMax) _skewMax = skew;
+    }
+
+    setDim(job);
+    if(_capped) {
+        _limitedFlushes++;
+    }
+
+    if(_failStreak >= SD_RECOVER_AFTER) {
+        busRecover();
+    }
+
+    if(job->tagged && _flushCb) {
+        _flushCb(job->tag, job->ready, _chipDone[order[0]], _chipDone[order[1]]);
+    }
+
+    _flushedSeq.store(job->seq, std::memory_order_release);
 }
 
-void sidDisplay::directCmd(uint8_t val)
+// Send command of given type to chips that don't have it yet
+void sidDisplay::sendCmd(int type, uint8_t val)
 {
+    if(!val)
+        return;
+    
     for(int j = 0; j < 2; j++) {
+        if(_lastCmd[j][type] == val)
+            continue;
         Wire.beginTransmission(_address[j]);
         Wire.write(val);
-        Wire.endTransmission();
+        _lastCmd[j][type] = txOK(j, Wire.endTransmission()) ? val : 0;
+        _busBytes += 2;
+    }
+}
+
+void sidDisplay::setFlushCallback(sdFlushCallback cb)
+{
+    _flushCb = cb;
+}
+
+// True if everything submitted so far has reached the chips
+bool sidDisplay::isFlushed()
+{
+    return (_flushedSeq.load(std::memory_order_acquire) == _submitSeq);
+}
+
+// Jobs replaced by a newer one before the flush task got to them
+uint32_t sidDisplay::getFlushesSkipped()
+{
+    return _jobs.getSkipped();
+}
+
+// Time stamp (CPU cycles, flushing core) of last RAM write per chip
+uint32_t sidDisplay::getChipDoneCycles(int chip)
+{
+    return _chipDone[chip];
+}
+
+// Updates that changed the RAM of both chips, and the average and
+// maximum time between the two chips' updates (us)
+uint32_t sidDisplay::getSkewCount()
+{
+    return _skewCount;
+}
+
+uint32_t sidDisplay::getSkewAvgUs()
+{
+    if(!_skewCount)
+        return 0;
+
+    return (uint32_t)(_skewCycles / _skewCount / ESP.getCpuFreqMHz());
+}
+
+uint32_t sidDisplay::getSkewMaxUs()
+{
+    return _skewMax / ESP.getCpuFreqMHz();
+}
+
+uint32_t sidDisplay::getShowCount()
+{
+    return _shows;
+}
+
+// Average duration of a RAM update in us; 1000000 / this is the
+// highest frame rate the bus can carry
+uint32_t sidDisplay::getShowAvgUs()
+{
+    if(!_shows)
+        return 0;
+        
+    return (uint32_t)(_showCycles / _shows / ESP.getCpuFreqMHz());
+}
+
+// Forget what the chips hold; next flush sends the entire RAM
+void sidDisplay::invalidateRAMCache()
+{
+    _want.ramEpoch++;
+}
+
+uint32_t sidDisplay::getBusBytes()
+{
+    return _busBytes;
+}
+
+uint32_t sidDisplay::getBusBytesSaved()
+{
+    return _busBytesSaved;
+}
+
+void sidDisplay::clearDisplayDirect()
+{
+    for(int j = 0; j < 2; j++) {
+        memset(_want.chip[j].ram, 0, sizeof(_want.chip[j].ram));
+    }
+    submit();
+}
+
+// Forget what was sent; next flush sends the wanted command of
+// each type unconditionally
+void sidDisplay::invalidateCmdCache()
+{
+    _want.cmdEpoch++;
+}
+
+uint32_t sidDisplay::getCmdsSaved()
+{
+    return _cmdsSaved;
+}
+
+// Send command to both chips. Oscillator, display setup (on/off/blink)
+// and dim commands are skipped for a chip that already has this exact
+// setting. Other commands are not supported.
+void sidDisplay::directCmd(uint8_t val)
+{
+    int type;
+
+    switch(val & 0xf0) {
+    case 0x20:
+        type = SD_CMD_OSC;
+        break;
+    case 0x80:
+        type = SD_CMD_DISP;
+        break;
+    case 0xe0:
+        type = SD_CMD_DIM;
+        break;
+    default:
+        return;
+    }
+    
+    if(_want.cmd[type] == val) {
+        _cmdsSaved += 2;
+        return;
     }
+    _want.cmd[type] = val;
+    submit();
 }
@@ -9,16 +9,199 @@
 #ifndef _SIDDISPLAY_H
 #define _SIDDISPLAY_H
 
+#include <esp_timer.h>
+
+#include "sid_frame.h"
+
 #define SD_BUF_SIZE   16  // Buffer size in words (16bit)
 
+#define SD_CMD_OSC    0   // Command types for elision cache
+#define SD_CMD_DISP   1
+#define SD_CMD_DIM    2
+#define SD_CMD_TYPES  3
+
+#define SD_FIELD_COLS 10
+#define SD_FIELD_ROWS 20
+#define SD_FIELD_MASK 0x000fffffUL
+
+/*
+ * Logical 10x20 bit plane, one 32-bit word per column (bar), bit 0 
+ * is the bottom row. Pixel coordinates are x = 0 left, y = 0 top,
+ * like in drawFieldAndShow(). Pixels outside the field are ignored.
+ */
+class sidField {
+
+    public:
+
+        void clear()
+        {
+            memset(col, 0, sizeof(col));
+        }
+
+        void setPixel(int x, int y)
+        {
+            if((unsigned)x < SD_FIELD_COLS && (unsigned)y < SD_FIELD_ROWS)
+                col[x] |= 1UL << (SD_FIELD_ROWS - 1 - y);
+        }
+
+        void clearPixel(int x, int y)
+        {
+            if((unsigned)x < SD_FIELD_COLS && (unsigned)y < SD_FIELD_ROWS)
+                col[x] &= ~(1UL << (SD_FIELD_ROWS - 1 - y));
+        }
+
+        bool getPixel(int x, int y) const
+        {
+            if((unsigned)x >= SD_FIELD_COLS || (unsigned)y >= SD_FIELD_ROWS)
+                return false;
+            return (col[x] >> (SD_FIELD_ROWS - 1 - y)) & 1;
+        }
+
+        // Blit operations
+        void orField(const sidField &f)
+        {
+            for(int i = 0; i < SD_FIELD_COLS; i++) col[i] |= f.col[i];
+        }
+
+        void andField(const sidField &f)
+        {
+            for(int i = 0; i < SD_FIELD_COLS; i++) col[i] &= f.col[i];
+        }
+
+        void andNotField(const sidField &f)
+        {
+            for(int i = 0; i < SD_FIELD_COLS; i++) col[i] &= ~f.col[i];
+        }
+
+        void xorField(const sidField &f)
+        {
+            for(int i = 0; i < SD_FIELD_COLS; i++) col[i] ^= f.col[i];
+        }
+
+        void invert()
+        {
+            for(int i = 0; i < SD_FIELD_COLS; i++) col[i] ^= SD_FIELD_MASK;
+        }
+
+        // Move contents by n pixels; pixels moved out are lost, 
+        // pixels moved in are dark. n <= 0 does nothing.
+        void shiftLeft(int n)
+        {
+            if(n <= 0) return;
+            if(n > SD_FIELD_COLS) n = SD_FIELD_COLS;
+            for(int i = 0; i < SD_FIELD_COLS; i++) 
+                col[i] = (i + n < SD_FIELD_COLS) ? col[i + n] : 0;
+        }
+
+        void shiftRight(int n)
+        {
+            if(n <= 0) return;
+            if(n > SD_FIELD_COLS) n = SD_FIELD_COLS;
+            for(int i = SD_FIELD_COLS - 1; i >= 0; i--) 
+                col[i] = (i - n >= 0) ? col[i - n] : 0;
+        }
+
+        void shiftUp(int n)
+        {
+            if(n <= 0) return;
+            for(int i = 0; i < SD_FIELD_COLS; i++) 
+                col[i] = (n < SD_FIELD_ROWS) ? ((col[i] << n) & SD_FIELD_MASK) : 0;
+        }
+
+        void shiftDown(int n)
+        {
+            if(n <= 0) return;
+            for(int i = 0; i < SD_FIELD_COLS; i++) 
+                col[i] = (n < SD_FIELD_ROWS) ? (col[i] >> n) : 0;
+        }
+
+        uint32_t col[SD_FIELD_COLS];
+};
+
+#define SD_FLUSH_STACK  3072
+#define SD_FLUSH_PRIO   2     // Above loop task; I2C waits yield to it
+
+#define SD_NOTIFY_JOB   0x01  // Flush task notification bits
+#define SD_NOTIFY_PLANE 0x02
+#define SD_NOTIFY_DIM   0x04
+
+#define SD_DIM_TICK     1000  // Master dimmer tick while fading/dithering (us)
+
+// Grayscale (bit planes)
+#define SD_GRAY_MAX_BITS  6
+#define SD_GRAY_AUTO      0     // Most bit planes that reach SD_GRAY_MIN_HZ
+#define SD_GRAY_MIN_HZ    100   // Refresh rate for SD_GRAY_AUTO
+#define SD_GRAY_MIN_UNIT  200   // Shortest plane time unit (us)
+
+#define SD_DUTY_FULL    4096  // LED duty cycle unit: 1/4096
+
+// Hardware blink rates (display setup command)
+#define SD_BLINK_OFF    0
+#define SD_BLINK_2HZ    1
+#define SD_BLINK_1HZ    2
+#define SD_BLINK_05HZ   3
+
+// RAM scrubber
+#define SD_SCRUB_WORDS    4     // Words read back per step
+#define SD_SCRUB_MIN_MS   10    // Shortest time between steps
+
+// I2C error handling
+#define SD_RETRY_MS       5     // Delay before a failed flush is repeated
+#define SD_RECOVER_AFTER  3     // Failed transactions in a row before bus recovery
+
+// Fonts
+#define SD_GLYPH_W      10    // alphaChars
+#define SD_GLYPH_H      10
+#define SD_GLYPH8_W     8     // alphaChars8
+#define SD_GLYPH8_H     8
+#define SD_MARQUEE_GAP  2     // Blank rows between marquee characters
+
+// Image of one chip's display RAM, in the order it is sent on the
+// bus: Start address byte, then RAM bytes (words are little endian 
+// like the HT16K33's; pad keeps ram[] aligned).
+struct sdChipImage {
+    uint8_t  pad;
+    uint8_t  cmd;
+    uint16_t ram[SD_BUF_SIZE / 2];
+};
+
+// Everything a flush brings the chips to. Each job carries the
+// complete wanted state, so a newer job can replace an older one.
+struct sdFlushJob {
+    uint32_t    seq;                // Set by publish()
+    uint32_t    ready;              // CPU cycles at submission
+    uint32_t    tag;                // Passed to flush callback
+    bool        tagged;
+    uint8_t     cmdEpoch;           // Changed by invalidateCmdCache()
+    uint8_t     ramEpoch;           // Changed by invalidateRAMCache()
+    uint8_t     cmd[SD_CMD_TYPES];  // Wanted osc/setup/dim command, 0 = none
+    uint8_t     grayBits;           // Bit planes, or SD_GRAY_AUTO
+    uint8_t     level[SD_FIELD_COLS];   // Column intensity
+    bool        dimmer;             // Master dimmer drives dim and on/off
+    uint8_t     master;             // Master dimmer target (0-255)
+    uint8_t     fadeGen;            // Changed by every setMaster()
+    uint16_t    fadeMs;             // Time to reach target
+    uint8_t     lit;                // Number of LEDs on in chip[]
+    sdChipImage chip[2];
+};
+
+// Called after a tagged job went out: tag, submission time, and
+// completion times of the chip written first and second (CPU
+// cycles, flushing core)
+typedef void (*sdFlushCallback)(uint32_t tag, uint32_t ready, uint32_t first, uint32_t second);
+
 class sidDisplay {
 
     public:
 
         sidDisplay(uint8_t address1, uint8_t address2);
         void begin();
+        bool beginAsync(int core);
         void on();
         void off();
+        void setBlink(uint8_t blink);
+        uint8_t getBlink();
+        bool isOn();
 
         void lampTest();
 
@@ -30,6 +213,7 @@ class sidDisplay {
         uint8_t getBrightness();
         
         void show();
+        void show(uint32_t tag);
 
         void clearDisplayDirect();
 
@@ -38,21 +222,176 @@ class sidDisplay {
         void clearBar(uint8_t bar);
         void drawDot(uint8_t bar, uint8_t dot_y);
 
+        void drawField(const sidField *field);
+        void getField(sidField *field);
+
         void drawFieldAndShow(uint8_t *fieldData);
 
         void drawLetterAndShow(char alpha, int x = 0, int y = 8);
         void drawLetterMask(char alpha, int x, int y);
         void drawClockAndShow(uint8_t *dateBuf, int dx, int dy);
 
+        void marqueeStart(const char *text);
+        void marqueeStep();
+
+        void     invalidateCmdCache();
+        uint32_t getCmdsSaved();
+
+        uint32_t getChipDoneCycles(int chip);
+        uint32_t getShowCount();
+        uint32_t getShowAvgUs();
+        uint32_t getSkewCount();
+        uint32_t getSkewAvgUs();
+        uint32_t getSkewMaxUs();
+
+        void     invalidateRAMCache();
+        uint32_t getBusBytes();
+        uint32_t getBusBytesSaved();
+
+        void     setMaster(uint8_t level, uint16_t fadeMs = 0);
+        uint8_t  getMaster();
+
+        void     setColumnLevel(uint8_t col, uint8_t level);
+        void     resetColumnLevels();
+        uint8_t  getColumnLevel(uint8_t col);
+        void     setGrayBits(uint8_t bits);
+        uint8_t  getGrayBits();
+        uint32_t getGrayUnitUs();
+        uint32_t getGrayRefreshHz();
+
+        void     setScrubBudget(uint32_t usPerSec);
+        uint32_t getScrubWords();
+        uint32_t getScrubRepairs();
+        uint32_t getScrubErrors();
+
+        uint32_t getTxErrors(int chip);
+        uint32_t getRetries();
+        uint32_t getBusRecoveries();
+
+        void     setCurrentBudget(uint16_t budgetMa, uint16_t ledMa);
+        uint32_t getLitLEDs();
+        uint32_t getCurrentMa();
+        uint32_t getLimitedFlushes();
+
+        void     setFlushCallback(sdFlushCallback cb);
+        bool     isFlushed();
+        uint32_t getFlushesSkipped();
+
     private:
         void directCmd(uint8_t val);
+        void submit();
+        void flush(const sdFlushJob *job);
+        void sendCmd(int type, uint8_t val);
+        void flushLoop();
+        void setGrayTiming(const sdFlushJob *job);
+        bool needPlanes(const sdFlushJob *job, int bits);
+        void flushPlane(const sdFlushJob *job, int plane, bool first);
+        static void flushTask(void *pvParameters);
+        static void grayTimerCb(void *arg);
+        void dimStep(const sdFlushJob *job, bool tick);
+        void setDim(const sdFlushJob *job);
+        static void dimTimerCb(void *arg);
+        void scrubStep();
+        bool txOK(int chip, uint8_t err);
+        void busRecover();
+
+        // Display RAM word idx (0-7 chip1, 8-15 chip2)
+        inline uint16_t& dbuf(int idx) { return _chip[idx >> 3].ram[idx & 7]; }
         
         uint8_t _address[2] = { 0, 0 };
 
         uint8_t _brightness = 15;     // current display brightness
+        uint8_t _blink = SD_BLINK_OFF;
         uint8_t _origBrightness = 15; // value from settings
         
-        uint16_t _displayBuffer[SD_BUF_SIZE];
+        // Display buffer, kept in the order it is sent to the chips,
+        // so each chip's image goes out with a single Wire.write().
+        sdChipImage _chip[2];
+
+        // State wanted by the caller; copied into a job by submit()
+        sdFlushJob _want;
+        uint32_t   _cmdsSaved = 0;    // Transactions suppressed
+
+        // Marquee: text (not copied), position and scrolled image
+        const char *_mqText = NULL;
+        int         _mqPos = 0;
+        uint8_t     _mqRow = 0;
+        sidField    _mqField;
+
+        // Async flush; without the task, submit() flushes directly
+        TaskHandle_t           _flushTask = NULL;
+        sidHandoff<sdFlushJob> _jobs;
+        std::atomic<uint32_t>  _flushedSeq{0};
+        uint32_t               _submitSeq = 0;
+        sdFlushCallback        _flushCb = NULL;
+        uint32_t               _scrubBudget = 0;  // Bus us per second
+        uint16_t               _budgetMa = 0;     // Current limit, 0 = none
+        uint16_t               _ledMa = 0;        // Per LED at full duty
+
+        // Everything below belongs to the flushing side
+
+        // Last command of each type sent to each chip (0 = unknown)
+        uint8_t  _lastCmd[2][SD_CMD_TYPES];
+        uint8_t  _cmdEpoch = 0;
+        uint8_t  _ramEpoch = 0;
+
+        // What the chips' RAM currently holds, as far as we know
+        uint16_t _sent[2][SD_BUF_SIZE / 2];
+
+        // Grayscale state
+        esp_timer_handle_t _grayTimer = NULL;
+        bool     _grayRunning = false;
+        uint8_t  _grayBits = 0;       // Effective number of planes
+        uint8_t  _grayPlane = 0;      // Plane currently shown
+        uint32_t _grayUnit = SD_GRAY_MIN_UNIT;  // us
+        uint32_t _planeUsMax = 0;     // Slowly decaying max plane write time
+
+        // Master dimmer state
+        esp_timer_handle_t _dimTimer = NULL;
+        bool          _dimTicking = false;
+        uint8_t       _fadeGen = 0;
+        uint32_t      _fadeFrom = 0;  // Master level, 8.8 fixed point
+        uint32_t      _fadeTo = 0;
+        uint32_t      _dimCur = 0;
+        unsigned long _fadeStart = 0;
+        uint16_t      _fadeMs = 0;
+        uint16_t      _ditherAcc = 0;   // Sigma-delta, 1/256 dim level
+        bool          _ditherUp = false;
+
+        // Current limiter state
+        uint8_t  _lit = 0;            // LEDs on in last flushed job
+        uint32_t _dutyCap = SD_DUTY_FULL;   // Highest duty allowed
+        uint32_t _dutyNow = SD_DUTY_FULL;   // Duty last set
+        bool     _capped = false;     // _dutyCap was in effect
+        uint32_t _limitedFlushes = 0;
+
+        // RAM scrubber state
+        unsigned long _scrubNext = 0; // millis() of next step
+        uint8_t       _scrubPos = 0;  // Next word to check (0-15)
+        uint32_t      _scrubWords = 0;
+        uint32_t      _scrubRepairs = 0;
+        uint32_t      _scrubErrors = 0;
+
+        // I2C error state
+        bool     _txFailed = false;   // Chips may not have the last job
+        uint8_t  _failStreak = 0;     // Failed transactions in a row
+        unsigned long _retryAt = 0;   // millis() of next retry
+        uint32_t _txErrors[2] = { 0, 0 };
+        uint32_t _retries = 0;
+        uint32_t _busRecoveries = 0;
+
+        // CPU cycle count at end of each chip's RAM write
+        uint32_t _chipDone[2] = { 0, 0 };
+
+        uint32_t _busBytes = 0;       // Bytes sent on I2C bus, incl. address
+        uint32_t _busBytesSaved = 0;  // Bytes not sent thanks to _sent
+
+        uint32_t _shows = 0;          // Number of RAM updates
+        uint64_t _showCycles = 0;     // CPU cycles spent in RAM updates
+
+        uint32_t _skewCount = 0;      // Updates of both chips' RAM
+        uint64_t _skewCycles = 0;     // Sum of time between the two
+        uint32_t _skewMax = 0;
 
 };
 
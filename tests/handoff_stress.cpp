@@ -0,0 +1,85 @@
+/*
+ * -------------------------------------------------------------------
+ * CircuitSetup.us SID - DMX-controlled
+ * (C) 2024 Thomas Winischhofer (A10001986)
+ * All rights reserved.
+ * -------------------------------------------------------------------
+ */
+
+// Host stress test for sidFrameHandoff: A producer thread publishes
+// as fast as it can, a consumer thread acquires as fast as it can. 
+// Every frame acquired must be whole (all fields written for the 
+// same publish), and seq must only increase.
+
+#include <stdio.h>
+#include <thread>
+#include <atomic>
+
+#include "../sid-DMX/sid_frame.h"
+
+#define NUM_FRAMES  5000000UL
+
+static sidFrameHandoff   frames;
+static std::atomic<bool> done(false);
+
+static void producer()
+{
+    for(uint32_t n = 1; n <= NUM_FRAMES; n++) {
+        sidFrame *f = frames.writeBuf();
+        f->stamp = n;
+        f->personality = n & 0x7f;
+        f->numSlots = n % SID_FRAME_SLOTS;
+        for(int i = 0; i < SID_FRAME_SLOTS; i++) {
+            f->slots[i] = (uint8_t)(n + i);
+        }
+        frames.publish();
+        // Give the consumer a chance on single core hosts
+        if(!(n & 0xff)) {
+            std::this_thread::yield();
+        }
+    }
+    done.store(true, std::memory_order_release);
+}
+
+int main()
+{
+    uint32_t lastSeq = 0, lastStamp = 0, got = 0, bad = 0;
+    std::thread prod(producer);
+
+    for(;;) {
+        bool fin = done.load(std::memory_order_acquire);
+        const sidFrame *f = frames.acquire();
+        if(!f) {
+            if(fin) break;
+            std::this_thread::yield();
+            continue;
+        }
+        got++;
+        if(f->seq <= lastSeq || f->stamp <= lastStamp || f->seq != f->stamp) {
+            bad++;
+        }
+        if(f->personality != (f->stamp & 0x7f) || f->numSlots != f->stamp % SID_FRAME_SLOTS) {
+            bad++;
+        }
+        for(int i = 0; i < SID_FRAME_SLOTS; i++) {
+            if(f->slots[i] != (uint8_t)(f->stamp + i)) {
+                bad++;
+                break;
+            }
+        }
+        lastSeq = f->seq;
+        lastStamp = f->stamp;
+    }
+
+    prod.join();
+
+    printf("handoff: %lu published, %u acquired, %u skipped, %u bad\n",
+          NUM_FRAMES, got, frames.getSkipped(), bad);
+
+    if(bad || lastStamp != NUM_FRAMES || got + frames.getSkipped() != NUM_FRAMES) {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * -------------------------------------------------------------------
+ * CircuitSetup.us SID - DMX-controlled
+ * (C) 2024 Thomas Winischhofer (A10001986)
+ * All rights reserved.
+ * -------------------------------------------------------------------
+ */
+
+// Host test for netdmx_parse(): Hand-built ArtDmx and E1.31 data
+// packets, valid and broken. A broken packet must be rejected, a
+// valid one must yield the right universe and slot count, with
+// slots pointing into the packet.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../sid-DMX/sid_netdmx.h"
+
+static uint8_t buf[1024];
+static int     failed = 0;
+
+static size_t artnet(uint16_t universe, uint16_t num)
+{
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, "Art-Net", 8);
+    buf[8] = 0x00;              // OpCode 0x5000, LE
+    buf[9] = 0x50;
+    buf[11] = 14;               // ProtVer
+    buf[12] = 42;               // Sequence
+    buf[14] = universe & 0xff;
+    buf[15] = universe >> 8;
+    buf[16] = num >> 8;
+    buf[17] = num & 0xff;
+    for(int i = 0; i < num; i++) {
+        buf[18 + i] = i + 1;
+    }
+    return 18 + num;
+}
+
+static size_t sacn(uint16_t universe, uint16_t num)
+{
+    memset(buf, 0, sizeof(buf));
+    buf[1] = 0x10;              // Preamble
+    memcpy(buf + 4, "ASC-E1.17", 9);
+    buf[21] = 0x04;             // Root vector
+    buf[43] = 0x02;             // Framing vector
+    buf[108] = 100;             // Priority
+    buf[111] = 7;               // Sequence
+    buf[113] = universe >> 8;
+    buf[114] = universe & 0xff;
+    buf[117] = 0x02;            // DMP vector
+    buf[118] = 0xa1;
+    buf[122] = 0x01;            // Increment
+    buf[123] = (num + 1) >> 8;  // Count incl. start code
+    buf[124] = (num + 1) & 0xff;
+    buf[125] = 0x00;            // Start code
+    for(int i = 0; i < num; i++) {
+        buf[126 + i] = i + 1;
+    }
+    return 126 + num;
+}
+
+static void expect(const char *name, size_t len, uint8_t proto, uint16_t universe, uint16_t num)
+{
+    netDMXPacket pkt;
+    uint8_t ret;
+
+    memset(&pkt, 0, sizeof(pkt));
+    ret = netdmx_parse(buf, len, &pkt);
+
+    if(ret != proto) {
+        printf("%s: returned %d, expected %d\n", name, ret, proto);
+        failed++;
+        return;
+    }
+    if(proto == NETDMX_NONE)
+        return;
+
+    if(pkt.proto != proto || pkt.universe != universe || pkt.numSlots != num) {
+        printf("%s: proto %d universe %d slots %d, expected %d %d %d\n", name,
+            pkt.proto, pkt.universe, pkt.numSlots, proto, universe, num);
+        failed++;
+        return;
+    }
+    if(pkt.slots < buf || pkt.slots + pkt.numSlots > buf + len ||
+       (num && pkt.slots[0] != 1) || (num && pkt.slots[num - 1] != (uint8_t)num)) {
+        printf("%s: slots do not point to the packet's data\n", name);
+        failed++;
+    }
+}
+
+int main()
+{
+    size_t len;
+
+    // Art-Net
+    len = artnet(0, 512);
+    expect("artnet full", len, NETDMX_ARTNET, 0, 512);
+    len = artnet(0x1234 & 0x7fff, 2);
+    expect("artnet net/subuni", len, NETDMX_ARTNET, 0x1234, 2);
+    len = artnet(3, 25);
+    expect("artnet odd length", len, NETDMX_ARTNET, 3, 25);
+    len = artnet(0, 512);
+    expect("artnet truncated", len - 1, NETDMX_NONE, 0, 0);
+    expect("artnet header only", 17, NETDMX_NONE, 0, 0);
+    len = artnet(0, 512);
+    buf[16] = 0x02;             // Length 513
+    buf[17] = 0x01;
+    expect("artnet length > 512", sizeof(buf), NETDMX_NONE, 0, 0);
+    len = artnet(0, 10);
+    buf[4] = 'n';
+    expect("artnet wrong id", len, NETDMX_NONE, 0, 0);
+    len = artnet(0, 10);
+    buf[9] = 0x21;              // OpPoll
+    expect("artnet wrong opcode", len, NETDMX_NONE, 0, 0);
+    len = artnet(0, 10);
+    buf[11] = 13;
+    expect("artnet old protver", len, NETDMX_NONE, 0, 0);
+
+    // sACN
+    len = sacn(1, 512);
+    expect("sacn full", len, NETDMX_SACN, 1, 512);
+    len = sacn(63999, 1);
+    expect("sacn one slot", len, NETDMX_SACN, 63999, 1);
+    len = sacn(1, 0);
+    expect("sacn start code only", len, NETDMX_SACN, 1, 0);
+    len = sacn(1, 512);
+    expect("sacn truncated", len - 1, NETDMX_NONE, 0, 0);
+    expect("sacn header only", 125, NETDMX_NONE, 0, 0);
+    len = sacn(1, 10);
+    buf[123] = 0;               // Count 0: not even a start code
+    buf[124] = 0;
+    expect("sacn count 0", len, NETDMX_NONE, 0, 0);
+    len = sacn(1, 10);
+    buf[6] = 'X';
+    expect("sacn wrong id", len, NETDMX_NONE, 0, 0);
+    len = sacn(1, 10);
+    buf[43] = 0x08;             // Sync packet
+    expect("sacn wrong vector", len, NETDMX_NONE, 0, 0);
+    len = sacn(1, 10);
+    buf[112] = 0x40;            // Stream terminated
+    expect("sacn terminated", len, NETDMX_NONE, 0, 0);
+    len = sacn(1, 10);
+    buf[125] = 0xcc;            // RDM start code
+    expect("sacn start code", len, NETDMX_NONE, 0, 0);
+
+    // Neither
+    expect("empty", 0, NETDMX_NONE, 0, 0);
+    memset(buf, 'A', 64);
+    expect("garbage", 64, NETDMX_NONE, 0, 0);
+
+    if(failed) {
+        printf("netdmx: %d FAILED\n", failed);
+        return 1;
+    }
+    printf("netdmx: OK\n");
+    return 0;
+}